@@ -0,0 +1,38 @@
+#!/bin/sh
+# Binary size, peak RSS and serial parser throughput of mavfwd builds
+#   make bench-compare, or bench/compare.sh ./mavfwd ./mavfwd-debug
+#
+# The "serial port" is a FIFO fed with bench/stream_gen output. mavfwd keeps it
+# open read-write, so the writer finishes once all but the last pipe buffer
+# (64KB) was parsed: the write time is the parse time.
+set -e
+
+MB=${MB:-32}
+AGGREGATE=${AGGREGATE:-10}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+"$(dirname "$0")/stream_gen" "$MB" > "$dir/stream.bin"
+bytes=$(wc -c < "$dir/stream.bin")
+
+printf "%-16s %10s %10s %10s\n" binary "size(B)" "RSS(KB)" "MB/s"
+for bin in "$@"; do
+	mkfifo "$dir/serial"
+	"$bin" -m "$dir/serial" -o 127.0.0.1:9 -a "$AGGREGATE" > "$dir/log.txt" 2>&1 &
+	pid=$!
+	sleep 0.5
+
+	start=$(date +%s%N)
+	cat "$dir/stream.bin" > "$dir/serial"
+	end=$(date +%s%N)
+
+	sleep 0.2
+	rss=$(awk '/^VmHWM/ {print $2}' "/proc/$pid/status")
+	kill -INT "$pid"
+	wait "$pid" || true
+	rm -f "$dir/serial"
+
+	size=$(wc -c < "$bin")
+	rate=$(awk -v b="$bytes" -v ns="$((end - start))" 'BEGIN {printf "%.1f", b / 1048576 / (ns / 1e9)}')
+	printf "%-16s %10s %10s %10s\n" "$(basename "$bin")" "$size" "$rss" "$rate"
+done
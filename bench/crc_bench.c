@@ -0,0 +1,102 @@
+// CRC16/MCRF4XX throughput of each checksum.h backend against the bytewise loop
+//   make bench && ./bench/crc_bench
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "../mavlink/checksum.h"
+
+typedef void (*crc_fn)(uint16_t *crc, const uint8_t *p, uint16_t length);
+
+static void run_table(uint16_t *crc, const uint8_t *p, uint16_t length) {
+	crc_accumulate_table(crc, p, length);
+}
+
+#ifdef MAVLINK_CRC_HAVE_CLMUL
+static void run_clmul(uint16_t *crc, const uint8_t *p, uint16_t length) {
+	if (length >= CRC_CLMUL_MIN_LEN)
+		crc_accumulate_clmul(crc, p, length);
+	else
+		crc_accumulate_table(crc, p, length);
+}
+#endif
+
+static const struct {
+	const char *name;
+	crc_fn fn;
+} backends[] = {
+	{"bytewise", crc_accumulate_bytewise},
+	{"slice-by-8", run_table},
+#ifdef MAVLINK_CRC_HAVE_CLMUL
+	{"clmul", run_clmul},
+#endif
+};
+#define NUM_BACKENDS (sizeof(backends) / sizeof(backends[0]))
+
+// TSC ticks on x86, nanoseconds elsewhere
+static uint64_t ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+int main(void) {
+	static uint8_t buf[65535];
+	const uint16_t sizes[] = {21, 43, 64, 128, 280, 2048, 65535};
+	int errors = 0;
+
+	srand(1);
+	for (size_t i = 0; i < sizeof(buf); i++)
+		buf[i] = rand();
+
+	crc_select_backend();
+	printf("selected backend: %s\n", crc_backend_name());
+
+	// every backend must agree with the bytewise reference
+	for (int len = 0; len < 1200; len++) {
+		uint16_t ref = X25_INIT_CRC ^ len;
+		crc_accumulate_bytewise(&ref, buf + len % 7, len);
+		for (size_t b = 1; b < NUM_BACKENDS; b++) {
+			uint16_t crc = X25_INIT_CRC ^ len;
+			backends[b].fn(&crc, buf + len % 7, len);
+			if (crc != ref) {
+				printf("%s mismatch at length %d: %04x != %04x\n", backends[b].name, len, crc,
+					ref);
+				errors++;
+			}
+		}
+	}
+
+#if defined(__x86_64__) || defined(__i386__)
+	printf("%-8s %-12s %12s %10s\n", "bytes", "backend", "bytes/cycle", "speedup");
+#else
+	printf("%-8s %-12s %12s %10s\n", "bytes", "backend", "bytes/ns", "speedup");
+#endif
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		uint16_t len = sizes[s];
+		unsigned iters = 64 * 1024 * 1024 / len;
+		double base = 0;
+		for (size_t b = 0; b < NUM_BACKENDS; b++) {
+			uint16_t crc = X25_INIT_CRC;
+			uint64_t t0 = ticks();
+			for (unsigned i = 0; i < iters; i++)
+				backends[b].fn(&crc, buf + (i & 7), len - 8 * (len > 8));
+			uint64_t t1 = ticks();
+			double rate = (double)iters * (len - 8 * (len > 8)) / (t1 - t0);
+			if (b == 0)
+				base = rate;
+			// crc is printed so the loop can't be optimized away
+			printf("%-8u %-12s %12.3f %9.1fx  (%04x)\n", len, backends[b].name, rate,
+				rate / base, crc);
+		}
+	}
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
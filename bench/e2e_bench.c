@@ -0,0 +1,302 @@
+// End to end throughput and latency of mavfwd, no hardware needed
+//   make bench-e2e, or ./bench/stream_gen 1 | ./bench/e2e_bench [-b ./mavfwd] [-r BYTES/S]
+//                                    [-d SECONDS] [-a 0,1,10,1024] [-- extra mavfwd options]
+//
+// A pty pair stands in for the UART: mavfwd opens the slave side, the bench
+// writes a MAVLink stream into the master side at the given byte rate and
+// receives mavfwd's output on a loopback UDP socket. Each frame is recognised
+// on the way out by its sequence number and CRC, which gives its latency from
+// serial write to UDP receive. The stream (stdin, or -f FILE) is any recording
+// of raw MAVLink frames; it is replayed in a loop for the duration of each run.
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../mavlink/common/mavlink.h"
+
+#define INFLIGHT_SLOTS 65536
+
+static uint64_t now_us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// Frames of the stream, back to back
+static uint8_t *stream;
+static size_t stream_len;
+static size_t *frame_off; // offset of each frame, plus the end
+static size_t frame_count;
+
+// Send time of the frames on their way, by key
+static struct {
+	uint32_t key;
+	uint64_t sent_us;
+} inflight[INFLIGHT_SLOTS];
+
+static uint32_t *latencies;
+static size_t latency_count;
+static size_t received;
+static volatile bool receiving;
+
+static size_t frame_len(const uint8_t *p, size_t avail) {
+	if (avail < 3)
+		return 0;
+	if (p[0] == MAVLINK_STX_MAVLINK1)
+		return p[1] + MAVLINK_NUM_NON_PAYLOAD_BYTES - 4;
+	if (p[0] == MAVLINK_STX)
+		return p[1] + MAVLINK_NUM_NON_PAYLOAD_BYTES +
+			   ((p[2] & MAVLINK_IFLAG_SIGNED) ? MAVLINK_SIGNATURE_BLOCK_LEN : 0);
+	return 0;
+}
+
+// Sequence number and CRC
+static uint32_t frame_key(const uint8_t *p, size_t len) {
+	size_t crc = len - 2;
+	uint8_t seq = p[2];
+	if (p[0] == MAVLINK_STX) {
+		seq = p[4];
+		if (p[2] & MAVLINK_IFLAG_SIGNED)
+			crc -= MAVLINK_SIGNATURE_BLOCK_LEN;
+	}
+	return (uint32_t)seq << 16 | p[crc] | p[crc + 1] << 8;
+}
+
+static unsigned slot_of(uint32_t key) {
+	return (key * 2654435761u) >> 16 & (INFLIGHT_SLOTS - 1);
+}
+
+static bool load_stream(const char *path) {
+	FILE *f = path ? fopen(path, "rb") : stdin;
+	if (!f) {
+		perror(path);
+		return false;
+	}
+	size_t cap = 1 << 20, n;
+	stream = malloc(cap);
+	while ((n = fread(stream + stream_len, 1, cap - stream_len, f)) > 0)
+		if ((stream_len += n) == cap)
+			stream = realloc(stream, cap *= 2);
+	if (f != stdin)
+		fclose(f);
+	return true;
+}
+
+// Keeps only the frames, so that every byte written can be matched
+static void index_frames() {
+	size_t cap = 1024, out = 0;
+	frame_off = malloc(cap * sizeof(*frame_off));
+	frame_count = 0;
+	for (size_t i = 0; i < stream_len;) {
+		size_t len = frame_len(stream + i, stream_len - i);
+		if (len == 0 || i + len > stream_len) {
+			i++;
+			continue;
+		}
+		if (frame_count + 2 > cap)
+			frame_off = realloc(frame_off, (cap *= 2) * sizeof(*frame_off));
+		memmove(stream + out, stream + i, len);
+		frame_off[frame_count++] = out;
+		out += len;
+		i += len;
+	}
+	frame_off[frame_count] = out;
+	stream_len = out;
+}
+
+static void *receiver(void *arg) {
+	int sock = *(int *)arg;
+	static uint8_t carry[65536 + MAVLINK_MAX_PACKET_LEN];
+	size_t have = 0;
+	uint8_t buf[65536];
+
+	while (receiving) {
+		ssize_t n = recv(sock, buf, sizeof(buf), 0);
+		if (n <= 0)
+			continue;
+		uint64_t t = now_us();
+
+		// Raw mode cuts frames across datagrams, reassemble the stream
+		memcpy(carry + have, buf, n);
+		have += n;
+		size_t i = 0;
+		while (i < have) {
+			size_t len = frame_len(carry + i, have - i);
+			if (len == 0) {
+				i++;
+				continue;
+			}
+			if (i + len > have)
+				break;
+			uint32_t key = frame_key(carry + i, len);
+			unsigned s = slot_of(key);
+			if (inflight[s].key == key && inflight[s].sent_us) {
+				latencies[latency_count++] = t - inflight[s].sent_us;
+				inflight[s].sent_us = 0;
+			}
+			received++;
+			i += len;
+		}
+		memmove(carry, carry + i, have - i);
+		have -= i;
+	}
+	return NULL;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void run(const char *mavfwd, long aggregate, long rate, double seconds, char **extra,
+	int nextra) {
+	int master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) || unlockpt(master)) {
+		perror("posix_openpt()");
+		exit(EXIT_FAILURE);
+	}
+	struct termios tio;
+	tcgetattr(master, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(master, TCSANOW, &tio);
+
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+	int rcvbuf = 8 << 20;
+	setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	struct timeval tv = {.tv_usec = 100000};
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	struct sockaddr_in sin = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+	socklen_t sl = sizeof(sin);
+	bind(sock, (struct sockaddr *)&sin, sizeof(sin));
+	getsockname(sock, (struct sockaddr *)&sin, &sl);
+
+	char out[32], agg[16];
+	snprintf(out, sizeof(out), "127.0.0.1:%d", ntohs(sin.sin_port));
+	snprintf(agg, sizeof(agg), "%ld", aggregate);
+	char *argv[32] = {(char *)mavfwd, "-m", ptsname(master), "-o", out, "-a", agg};
+	int argc = 7;
+	for (int i = 0; i < nextra && argc < 31; i++)
+		argv[argc++] = extra[i];
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		int null = open("/dev/null", O_WRONLY);
+		dup2(null, STDOUT_FILENO);
+		dup2(null, STDERR_FILENO);
+		execv(mavfwd, argv);
+		_exit(127);
+	}
+	usleep(300000);
+
+	memset(inflight, 0, sizeof(inflight));
+	latency_count = received = 0;
+	receiving = true;
+	pthread_t th;
+	pthread_create(&th, NULL, receiver, &sock);
+
+	// Whole frames, paced to the byte rate
+	uint64_t start = now_us(), limit = seconds * 1e6;
+	size_t written = 0, sent = 0;
+	for (size_t i = 0; now_us() - start < limit; i = (i + 1) % frame_count) {
+		size_t len = frame_off[i + 1] - frame_off[i];
+		uint64_t due = start + written * 1000000 / rate;
+		uint64_t t = now_us();
+		if (due > t)
+			usleep(due - t);
+
+		const uint8_t *p = stream + frame_off[i];
+		uint32_t key = frame_key(p, len);
+		unsigned s = slot_of(key);
+		inflight[s].key = key;
+		inflight[s].sent_us = now_us();
+		if (write(master, p, len) != (ssize_t)len) {
+			perror("write()");
+			break;
+		}
+		written += len;
+		sent++;
+	}
+	double elapsed = (now_us() - start) / 1e6;
+
+	usleep(500000);
+	receiving = false;
+	pthread_join(th, NULL);
+
+	struct rusage ru;
+	kill(pid, SIGINT);
+	wait4(pid, NULL, 0, &ru);
+	close(sock);
+	close(master);
+	double cpu_us = ru.ru_utime.tv_sec * 1e6 + ru.ru_utime.tv_usec + ru.ru_stime.tv_sec * 1e6 +
+					ru.ru_stime.tv_usec;
+
+	qsort(latencies, latency_count, sizeof(*latencies), cmp_u32);
+#define PCT(p) (latency_count ? latencies[(size_t)((latency_count - 1) * (p))] : 0)
+	printf("%9ld %10.0f %10.0f %12.2f %9u %9u %9u %8zu\n", aggregate, sent / elapsed,
+		received / elapsed, received ? cpu_us / received : 0.0, PCT(0.5), PCT(0.99), PCT(0.999),
+		sent > received ? sent - received : 0);
+}
+
+int main(int argc, char **argv) {
+	const char *mavfwd = "./mavfwd", *file = NULL;
+	char modes[64] = "0,1,10,1024";
+	long rate = 100000;
+	double seconds = 3;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:r:d:a:f:h")) != -1) {
+		switch (opt) {
+		case 'b':
+			mavfwd = optarg;
+			break;
+		case 'r':
+			rate = atol(optarg);
+			break;
+		case 'd':
+			seconds = atof(optarg);
+			break;
+		case 'a':
+			snprintf(modes, sizeof(modes), "%s", optarg);
+			break;
+		case 'f':
+			file = optarg;
+			break;
+		default:
+			printf("Usage: %s [-b mavfwd] [-r bytes/s] [-d seconds] [-a modes] [-f stream] "
+				   "[-- mavfwd options]\n",
+				argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!load_stream(file))
+		return EXIT_FAILURE;
+	index_frames();
+	if (frame_count == 0) {
+		printf("No MAVLink frames in the stream\n");
+		return EXIT_FAILURE;
+	}
+	// enough for every frame the run can send
+	latencies = malloc((size_t)(rate * seconds / 8 + 1) * sizeof(*latencies));
+
+	printf("%s at %ld B/s for %.1fs, %zu distinct frames\n", mavfwd, rate, seconds, frame_count);
+	printf("%9s %10s %10s %12s %9s %9s %9s %8s\n", "aggregate", "sent/s", "frames/s",
+		"cpu us/frame", "p50 us", "p99 us", "p99.9 us", "lost");
+	for (char *save, *m = strtok_r(modes, ",", &save); m; m = strtok_r(NULL, ",", &save))
+		run(mavfwd, atol(m), rate, seconds, argv + optind, argc - optind);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,77 @@
+#!/bin/sh
+# Recovered loss and CPU time per datagram of the fec outputs
+#   make bench-fec, or bench/fec.sh ./mavfwd
+#
+# A bench/stream_gen stream goes through a FIFO to mavfwd, whose output with
+# fec=$FEC is sent through bench/loss_relay to a mavfwd --decode. For each
+# loss rate and burst length of the relay's Gilbert-Elliott model, the loss
+# seen by the ground without FEC (the relay's) is compared with the loss left
+# after it rebuilt what it could: 1 - datagrams out of the ground / data
+# datagrams sent by the air side. A last run packs a stream of random
+# payloads (bench/stream_gen PAYLOAD) in batches of 2048 bytes, envelopes
+# that stay uncompressed at the largest size fec takes: no datagram may be
+# counted broken there.
+set -e
+
+bin=${1:-./mavfwd}
+MB=${MB:-1}
+FEC=${FEC:-8/12}
+AGGREGATE=${AGGREGATE:-10}
+LOSSES=${LOSSES:-0.01 0.05 0.1 0.2}
+BURSTS=${BURSTS:-1 3}
+PORT=${PORT:-14670}
+BLOB_LOSS=${BLOB_LOSS:-0.05}
+bench=$(dirname "$0")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+"$bench/stream_gen" "$MB" > "$dir/stream.bin"
+# 8 frames of random bytes fill a datagram
+"$bench/stream_gen" "$MB" 244 > "$dir/blob.bin"
+
+# run STREAM OPTIONS LOSS BURST prints a row of the table
+run() {
+	"$bin" --decode -i "127.0.0.1:$((PORT + 1))" -o 127.0.0.1:9 > "$dir/ground.txt" 2>&1 &
+	ground=$!
+	"$bench/loss_relay" -l "$3" -b "$4" "$PORT" "$((PORT + 1))" > "$dir/relay.txt" &
+	relay=$!
+	mkfifo "$dir/serial"
+	"$bin" -m "$dir/serial" -a "$AGGREGATE" -o "127.0.0.1:$PORT,fec=$FEC$2" -i 127.0.0.1:0 \
+		> "$dir/air.txt" 2>&1 &
+	air=$!
+	sleep 0.5
+
+	cat "$1" > "$dir/serial"
+	sleep 0.3
+	kill -INT "$air"
+	wait "$air" || true
+	sleep 0.3
+	kill -INT "$relay" "$ground"
+	wait "$relay" "$ground" || true
+	rm -f "$dir/serial"
+
+	sent=$(sed -n 's/.*fec .*, \([0-9]*\) data and.*/\1/p' "$dir/air.txt")
+	enc=$(sed -n 's/.*bytes, \([0-9.]*\)us per data datagram/\1/p' "$dir/air.txt")
+	link=$(sed -n 's/.*dropped (\([0-9.]*\)%).*/\1/p' "$dir/relay.txt")
+	got=$(sed -n 's/^Endpoint .*: \([0-9]*\) datagrams.*/\1/p' "$dir/ground.txt")
+	rebuilt=$(sed -n 's/.*datagrams, \([0-9]*\) rebuilt.*/\1/p' "$dir/ground.txt")
+	broken=$(sed -n 's/.*, \([0-9]*\) broken, [0-9.]*us per datagram/\1/p' "$dir/ground.txt")
+	dec=$(sed -n 's/.*broken, \([0-9.]*\)us per datagram/\1/p' "$dir/ground.txt")
+	left=$(awk -v s="$sent" -v g="$got" 'BEGIN {printf "%.2f", s ? 100 * (s - g) / s : 0}')
+	printf "%-6s %-6s %9s%% %9s%% %8s %7s %12s %12s\n" "$3" "$4" "$link" "$left" \
+		"$rebuilt" "$broken" "$enc" "$dec"
+}
+
+printf "%-6s %-6s %10s %10s %8s %7s %12s %12s\n" loss burst "link loss" "left loss" "rebuilt" \
+	broken "enc us/dgm" "dec us/dgm"
+for burst in $BURSTS; do
+	for loss in $LOSSES; do
+		run "$dir/stream.bin" "" "$loss" "$burst"
+	done
+done
+echo "incompressible 2048 byte batches, pack:"
+run "$dir/blob.bin" ",pack" "$BLOB_LOSS" 1
+if [ "$broken" != 0 ]; then
+	echo "full size datagrams were counted broken"
+	exit 1
+fi
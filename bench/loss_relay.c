@@ -0,0 +1,99 @@
+// UDP relay that drops datagrams like a lossy radio link, for bench/fec.sh
+//   ./bench/loss_relay [-l LOSS] [-b BURST] [-s SEED] LISTEN_PORT DEST_PORT
+//
+// The losses follow a Gilbert-Elliott model: the link goes from good to bad
+// and back, every datagram sent while it is bad is lost. -l is the share of
+// datagrams lost on average (0.05 by default), -b the mean length of a burst
+// of losses (1 by default, independent losses). Runs until SIGINT or SIGTERM
+// and prints what it forwarded and dropped.
+#include <arpa/inet.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig) {
+	(void)sig;
+	stop = 1;
+}
+
+int main(int argc, char **argv) {
+	double loss = 0.05, burst = 1;
+	unsigned seed = 1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "l:b:s:h")) != -1) {
+		switch (opt) {
+		case 'l':
+			loss = atof(optarg);
+			break;
+		case 'b':
+			burst = atof(optarg);
+			break;
+		case 's':
+			seed = atoi(optarg);
+			break;
+		default:
+			printf("Usage: %s [-l loss] [-b burst] [-s seed] listen_port dest_port\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (argc - optind != 2 || loss < 0 || loss >= 1 || burst < 1) {
+		printf("Usage: %s [-l loss] [-b burst] [-s seed] listen_port dest_port\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+	int rcvbuf = 8 << 20;
+	setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	struct sockaddr_in in = {.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+		.sin_port = htons(atoi(argv[optind]))};
+	struct sockaddr_in out = in;
+	out.sin_port = htons(atoi(argv[optind + 1]));
+	if (bind(sock, (struct sockaddr *)&in, sizeof(in))) {
+		perror("bind()");
+		return EXIT_FAILURE;
+	}
+
+	struct sigaction sa = {.sa_handler = on_signal};
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	// bad -> good with 1 / burst, good -> bad so that the bad state lasts loss of the time
+	double to_good = 1 / burst, to_bad = loss / (1 - loss) * to_good;
+	bool bad = false;
+	unsigned long forwarded = 0, dropped = 0, bursts = 0;
+	static char buf[65536];
+
+	srand(seed);
+	while (!stop) {
+		ssize_t n = recv(sock, buf, sizeof(buf), 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("recv()");
+			break;
+		}
+		double r = rand() / (RAND_MAX + 1.0);
+		if (bad ? r < to_good : r < to_bad) {
+			bad = !bad;
+			bursts += bad;
+		}
+		if (bad) {
+			dropped++;
+			continue;
+		}
+		if (sendto(sock, buf, n, 0, (struct sockaddr *)&out, sizeof(out)) == n)
+			forwarded++;
+	}
+
+	printf("relay: %lu forwarded, %lu dropped (%.2f%%) in %lu bursts\n", forwarded, dropped,
+		forwarded + dropped ? 100.0 * dropped / (forwarded + dropped) : 0.0, bursts);
+	return EXIT_SUCCESS;
+}
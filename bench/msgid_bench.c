@@ -0,0 +1,106 @@
+// Message entry lookup: bisection against the O(1) index, over an ArduPilot-like msgid mix
+//   make bench && ./bench/msgid_bench
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "../mavlink/common/mavlink.h"
+
+// msgid and relative rate of a typical ArduPilot telemetry stream (SRx_ defaults on a
+// copter with a GCS and a Remote ID module). Ids 150-230 and 11000+ are ardupilotmega
+// messages the common dialect doesn't know, they take the "not found" path.
+static const struct {
+	uint32_t msgid;
+	unsigned weight;
+} mix[] = {
+	{MAVLINK_MSG_ID_ATTITUDE, 50},
+	{MAVLINK_MSG_ID_GLOBAL_POSITION_INT, 10},
+	{MAVLINK_MSG_ID_VFR_HUD, 10},
+	{MAVLINK_MSG_ID_RC_CHANNELS, 10},
+	{MAVLINK_MSG_ID_SERVO_OUTPUT_RAW, 10},
+	{MAVLINK_MSG_ID_RAW_IMU, 10},
+	{MAVLINK_MSG_ID_SCALED_IMU2, 10},
+	{MAVLINK_MSG_ID_SCALED_PRESSURE, 10},
+	{MAVLINK_MSG_ID_SYS_STATUS, 4},
+	{MAVLINK_MSG_ID_GPS_RAW_INT, 5},
+	{MAVLINK_MSG_ID_NAV_CONTROLLER_OUTPUT, 4},
+	{MAVLINK_MSG_ID_MISSION_CURRENT, 2},
+	{MAVLINK_MSG_ID_SYSTEM_TIME, 1},
+	{MAVLINK_MSG_ID_HEARTBEAT, 1},
+	{MAVLINK_MSG_ID_BATTERY_STATUS, 2},
+	{MAVLINK_MSG_ID_POWER_STATUS, 2},
+	{MAVLINK_MSG_ID_VIBRATION, 2},
+	{MAVLINK_MSG_ID_EXTENDED_SYS_STATE, 2},
+	{MAVLINK_MSG_ID_HOME_POSITION, 1},
+	{MAVLINK_MSG_ID_TIMESYNC, 1},
+	{MAVLINK_MSG_ID_TERRAIN_REPORT, 1},
+	{MAVLINK_MSG_ID_PARAM_VALUE, 3},
+	{MAVLINK_MSG_ID_STATUSTEXT, 1},
+	{152, 2},	// MEMINFO
+	{163, 4},	// AHRS
+	{178, 4},	// AHRS2
+	{193, 2},	// EKF_STATUS_REPORT
+	{11030, 4}, // ESC_TELEMETRY_1_TO_4
+	{MAVLINK_MSG_ID_OPEN_DRONE_ID_LOCATION, 1},
+	{MAVLINK_MSG_ID_OPEN_DRONE_ID_SYSTEM, 1},
+	{MAVLINK_MSG_ID_OPEN_DRONE_ID_BASIC_ID, 1},
+};
+
+static uint64_t ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+int main(void) {
+	static uint32_t ids[1 << 16];
+	const unsigned n = sizeof(ids) / sizeof(ids[0]);
+	const unsigned rounds = 200;
+	unsigned total = 0, errors = 0;
+
+	// both lookups must agree on every id a MAVLink 2 frame can carry up to the highest used
+	for (uint32_t id = 0; id < 70000; id++) {
+		if (mavlink_get_msg_entry(id) != mavlink_get_msg_entry_bisect(id)) {
+			printf("lookup mismatch for msgid %u\n", id);
+			errors++;
+		}
+	}
+
+	for (size_t i = 0; i < sizeof(mix) / sizeof(mix[0]); i++)
+		total += mix[i].weight;
+	srand(1);
+	for (unsigned i = 0; i < n; i++) {
+		unsigned r = rand() % total;
+		size_t m = 0;
+		while (r >= mix[m].weight)
+			r -= mix[m++].weight;
+		ids[i] = mix[m].msgid;
+	}
+
+	const char *names[] = {"bisect", "index"};
+	for (int impl = 0; impl < 2; impl++) {
+		unsigned sum = 0;
+		uint64_t t0 = ticks();
+		for (unsigned r = 0; r < rounds; r++) {
+			for (unsigned i = 0; i < n; i++) {
+				const mavlink_msg_entry_t *e = impl ? mavlink_get_msg_entry(ids[i])
+													: mavlink_get_msg_entry_bisect(ids[i]);
+				sum += e ? e->crc_extra : 1;
+			}
+		}
+		uint64_t t1 = ticks();
+#if defined(__x86_64__) || defined(__i386__)
+		printf("%-8s %6.2f cycles/lookup  (%u)\n", names[impl], (double)(t1 - t0) / n / rounds, sum);
+#else
+		printf("%-8s %6.2f ns/lookup  (%u)\n", names[impl], (double)(t1 - t0) / n / rounds, sum);
+#endif
+	}
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,45 @@
+#!/bin/sh
+# Compression ratio and CPU time per datagram of the pack envelopes
+#   make bench-pack, or bench/pack.sh ./mavfwd
+#
+# A bench/stream_gen stream goes through a FIFO to mavfwd, which has a packing
+# output for each aggregation in AGGREGATE, all sent to a mavfwd --decode.
+# Both print the envelope counters of their summary. stream_gen repeats the
+# same payloads, a flight log compresses less. At the pace of the FIFO the
+# ground socket can overflow, the ground counters then cover fewer datagrams.
+set -e
+
+bin=${1:-./mavfwd}
+MB=${MB:-4}
+AGGREGATE=${AGGREGATE:-1 10 1024}
+PORT=${PORT:-14660}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+"$(dirname "$0")/stream_gen" "$MB" > "$dir/stream.bin"
+
+outs=
+for agg in $AGGREGATE; do
+	outs="$outs -o 127.0.0.1:$PORT,pack,agg=$agg"
+done
+
+"$bin" --decode -i "127.0.0.1:$PORT" -o 127.0.0.1:9 > "$dir/ground.txt" 2>&1 &
+ground=$!
+mkfifo "$dir/serial"
+# shellcheck disable=SC2086
+"$bin" -m "$dir/serial" $outs -i 127.0.0.1:0 > "$dir/air.txt" 2>&1 &
+air=$!
+sleep 0.5
+
+cat "$dir/stream.bin" > "$dir/serial"
+sleep 0.5
+kill -INT "$air"
+wait "$air" || true
+sleep 0.2
+kill -INT "$ground"
+wait "$ground" || true
+
+echo "air side, one output per aggregation ($AGGREGATE):"
+grep "packed" "$dir/air.txt"
+echo "ground side:"
+grep "envelopes" "$dir/ground.txt"
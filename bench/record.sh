@@ -0,0 +1,24 @@
+#!/bin/sh
+# Forwarding latency and CPU cost of mavfwd with and without --record
+#   make bench-record, or bench/record.sh ./mavfwd
+#
+# Runs bench/e2e_bench twice on the same stream, the second time recording to
+# a ring file in /dev/shm (or TMPDIR). The recorder should not move the
+# latency percentiles nor the CPU time per frame beyond the run to run noise.
+set -e
+
+bin=${1:-./mavfwd}
+RATE=${RATE:-200000}
+SECONDS_PER_RUN=${SECONDS_PER_RUN:-3}
+AGGREGATE=${AGGREGATE:-1,10}
+dir=$(mktemp -d "${TMPDIR:-/dev/shm}/mavfwd-rec.XXXXXX")
+trap 'rm -rf "$dir"' EXIT
+
+bench=$(dirname "$0")
+"$bench/stream_gen" 1 > "$dir/stream.bin"
+
+echo "without --record"
+"$bench/e2e_bench" -b "$bin" -r "$RATE" -d "$SECONDS_PER_RUN" -a "$AGGREGATE" -f "$dir/stream.bin"
+echo "with --record $dir/rec,4096"
+"$bench/e2e_bench" -b "$bin" -r "$RATE" -d "$SECONDS_PER_RUN" -a "$AGGREGATE" -f "$dir/stream.bin" \
+	-- --record "$dir/rec,4096"
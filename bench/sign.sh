@@ -0,0 +1,51 @@
+#!/bin/sh
+# Signed frames checked by a ground station on two outputs at once
+#   make bench-sign, or bench/sign.sh ./mavfwd
+#
+# A bench/stream_gen stream goes through a FIFO to mavfwd --sign, which sends
+# it to an output of each aggregation in AGGREGATE. The outputs drain their
+# priority classes in their own order, bench/sign_check verifies every frame
+# they send with the signing streams of a ground station of its own and
+# fails on a bad signature or a replayed timestamp.
+set -e
+
+bin=${1:-./mavfwd}
+MB=${MB:-1}
+AGGREGATE=${AGGREGATE:-1 10}
+PORT=${PORT:-14670}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+"$(dirname "$0")/stream_gen" "$MB" > "$dir/stream.bin"
+head -c 32 /dev/urandom > "$dir/key"
+
+outs= ports= port=$PORT
+for agg in $AGGREGATE; do
+	outs="$outs -o 127.0.0.1:$port,agg=$agg"
+	ports="$ports $port"
+	port=$((port + 1))
+done
+
+# shellcheck disable=SC2086
+"$(dirname "$0")/sign_check" -k "$dir/key" $ports > "$dir/ground.txt" 2>&1 &
+ground=$!
+mkfifo "$dir/serial"
+# shellcheck disable=SC2086
+"$bin" -m "$dir/serial" $outs -i 127.0.0.1:0 --sign "$dir/key" > "$dir/air.txt" 2>&1 &
+air=$!
+sleep 0.5
+
+cat "$dir/stream.bin" > "$dir/serial"
+sleep 0.5
+kill -INT "$air"
+wait "$air" || true
+sleep 0.2
+kill -INT "$ground"
+status=0
+wait "$ground" || status=$?
+
+echo "air side, one output per aggregation ($AGGREGATE):"
+grep "Signing" "$dir/air.txt"
+echo "ground side:"
+cat "$dir/ground.txt"
+exit $status
@@ -0,0 +1,153 @@
+// Verifies the signed frames mavfwd sends to one or more outputs, for bench/sign.sh
+//   ./bench/sign_check -k KEYFILE PORT...
+//
+// Listens on each loopback UDP port and checks every frame as a ground station
+// would, with mavlink_signature_check() and its own signing streams per port:
+// a timestamp that isn't newer than the last one of its stream is a replay.
+// Runs until SIGINT or SIGTERM, prints the counts per port and fails if any
+// frame didn't pass.
+#include <arpa/inet.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../mavlink/common/mavlink.h"
+
+#define MAX_PORTS 8
+
+static volatile sig_atomic_t stop;
+
+static struct {
+	int sock;
+	int port;
+	mavlink_signing_t signing;
+	mavlink_signing_streams_t streams;
+	unsigned long frames, verified, unsigned_frames, bad, replayed;
+} ports[MAX_PORTS];
+
+static void on_signal(int sig) {
+	(void)sig;
+	stop = 1;
+}
+
+// 32 bytes raw, as written by bench/sign.sh
+static bool load_key(const char *path, uint8_t key[32]) {
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		perror(path);
+		return false;
+	}
+	size_t n = fread(key, 1, 32, f);
+	fclose(f);
+	if (n != 32)
+		printf("%s: expected a 32 byte raw key\n", path);
+	return n == 32;
+}
+
+static void check_frame(int p, const uint8_t *frame, size_t len) {
+	ports[p].frames++;
+	if (frame[0] != MAVLINK_STX || !(frame[2] & MAVLINK_IFLAG_SIGNED)) {
+		ports[p].unsigned_frames++;
+		return;
+	}
+
+	mavlink_message_t msg;
+	uint8_t plen = frame[1];
+	memcpy(&msg.magic, frame, MAVLINK_NUM_HEADER_BYTES);
+	memcpy(_MAV_PAYLOAD_NON_CONST(&msg), frame + MAVLINK_NUM_HEADER_BYTES, plen);
+	memcpy(msg.ck, frame + MAVLINK_NUM_HEADER_BYTES + plen, sizeof(msg.ck));
+	memcpy(msg.signature, frame + len - MAVLINK_SIGNATURE_BLOCK_LEN, sizeof(msg.signature));
+	if (mavlink_signature_check(&ports[p].signing, &ports[p].streams, &msg))
+		ports[p].verified++;
+	else if (ports[p].signing.last_status == MAVLINK_SIGNING_STATUS_REPLAY)
+		ports[p].replayed++;
+	else
+		ports[p].bad++;
+}
+
+static void check_datagram(int p, const uint8_t *buf, size_t n) {
+	for (size_t i = 0; i + 3 <= n;) {
+		size_t len;
+		if (buf[i] == MAVLINK_STX_MAVLINK1)
+			len = buf[i + 1] + MAVLINK_NUM_NON_PAYLOAD_BYTES - 4;
+		else if (buf[i] == MAVLINK_STX)
+			len = buf[i + 1] + MAVLINK_NUM_NON_PAYLOAD_BYTES +
+				  ((buf[i + 2] & MAVLINK_IFLAG_SIGNED) ? MAVLINK_SIGNATURE_BLOCK_LEN : 0);
+		else
+			return; // an output of this bench never cuts frames
+		if (i + len > n)
+			return;
+		check_frame(p, buf + i, len);
+		i += len;
+	}
+}
+
+int main(int argc, char **argv) {
+	const char *keyfile = NULL;
+	uint8_t key[32];
+	struct pollfd fds[MAX_PORTS];
+	int opt, count = 0;
+
+	while ((opt = getopt(argc, argv, "k:h")) != -1) {
+		switch (opt) {
+		case 'k':
+			keyfile = optarg;
+			break;
+		default:
+			printf("Usage: %s -k keyfile port...\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (!keyfile || optind == argc || argc - optind > MAX_PORTS) {
+		printf("Usage: %s -k keyfile port... (up to %d ports)\n", argv[0], MAX_PORTS);
+		return EXIT_FAILURE;
+	}
+	if (!load_key(keyfile, key))
+		return EXIT_FAILURE;
+
+	for (int i = optind; i < argc; i++, count++) {
+		int sock = socket(AF_INET, SOCK_DGRAM, 0);
+		int rcvbuf = 8 << 20;
+		setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+		struct sockaddr_in sin = {.sin_family = AF_INET,
+			.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+			.sin_port = htons(atoi(argv[i]))};
+		if (bind(sock, (struct sockaddr *)&sin, sizeof(sin))) {
+			perror("bind()");
+			return EXIT_FAILURE;
+		}
+		ports[count].sock = sock;
+		ports[count].port = atoi(argv[i]);
+		memcpy(ports[count].signing.secret_key, key, sizeof(key));
+		fds[count] = (struct pollfd){.fd = sock, .events = POLLIN};
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	uint8_t buf[65536];
+	while (!stop) {
+		if (poll(fds, count, 100) <= 0)
+			continue;
+		for (int p = 0; p < count; p++) {
+			if (!(fds[p].revents & POLLIN))
+				continue;
+			ssize_t n = recv(ports[p].sock, buf, sizeof(buf), 0);
+			if (n > 0)
+				check_datagram(p, buf, n);
+		}
+	}
+
+	bool ok = true;
+	for (int p = 0; p < count; p++) {
+		printf("port %d: %lu frames, %lu verified, %lu unsigned, %lu bad, %lu replayed\n",
+			ports[p].port, ports[p].frames, ports[p].verified, ports[p].unsigned_frames,
+			ports[p].bad, ports[p].replayed);
+		ok &= ports[p].frames > 0 && ports[p].verified == ports[p].frames;
+	}
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,81 @@
+// Writes a telemetry-like MAVLink 2 stream to stdout, input for bench/compare.sh
+//   ./bench/stream_gen [MB] [PAYLOAD] > stream.bin
+//
+// With PAYLOAD, the stream is ENCAPSULATED_DATA frames of random bytes instead,
+// which don't compress. Their payloads cycle through 8 lengths around PAYLOAD
+// (10 to 248), from PAYLOAD-7 to PAYLOAD+7, so that no two frame headers of 8
+// frames in a row are alike either: 244 gives 2048 bytes every 8 frames.
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../mavlink/common/mavlink.h"
+
+// Roughly an ArduPilot stream: attitude heavy, a few GPS/RC/status messages
+static void telemetry_pack(mavlink_message_t *msg, uint32_t i) {
+	switch (i % 10) {
+	case 0:
+		mavlink_msg_heartbeat_pack(1, 1, msg, MAV_TYPE_QUADROTOR, MAV_AUTOPILOT_ARDUPILOTMEGA, 0,
+			i, MAV_STATE_ACTIVE);
+		break;
+	case 1:
+	case 4:
+	case 7:
+		mavlink_msg_attitude_pack(1, 1, msg, i, 0.1f, 0.2f, 0.3f, 0.01f, 0.02f, 0.03f);
+		break;
+	case 2:
+		mavlink_msg_gps_raw_int_pack(1, 1, msg, i, 3, 473977418, 85455939, 10000, 100, 100, 500,
+			9000, 12, 0, 0, 0, 0, 0, 0);
+		break;
+	case 3:
+		mavlink_msg_rc_channels_pack(1, 1, msg, i, 16, 1500, 1500, 1000, 1500, 1100, 1200, 1300,
+			1400, 1500, 1600, 1700, 1800, 1900, 2000, 1500, 1500, 0, 0, 200);
+		break;
+	case 5:
+		mavlink_msg_sys_status_pack(1, 1, msg, 0, 0, 0, 500, 12600, 1000, 80, 0, 0, 0, 0, 0, 0, 0,
+			0, 0);
+		break;
+	case 6:
+		mavlink_msg_vfr_hud_pack(1, 1, msg, 10.0f, 11.0f, 90, 50, 100.0f, 0.5f);
+		break;
+	default:
+		mavlink_msg_global_position_int_pack(
+			1, 1, msg, i, 473977418, 85455939, 100000, 50000, 100, 100, 0, 9000);
+		break;
+	}
+}
+
+// The 2 byte sequence number comes first, the zeros after the last byte are trimmed
+static void blob_pack(mavlink_message_t *msg, uint32_t i, int payload) {
+	uint8_t data[MAVLINK_MSG_ENCAPSULATED_DATA_FIELD_DATA_LEN] = {0};
+	for (int k = 0; k < payload - 2; k++)
+		data[k] = rand();
+	data[payload - 3] |= 1;
+	mavlink_msg_encapsulated_data_pack(1, 1, msg, i, data);
+}
+
+int main(int argc, char **argv) {
+	size_t target = (argc > 1 ? atol(argv[1]) : 32) << 20;
+	int payload = argc > 2 ? atoi(argv[2]) : 0;
+	size_t written = 0;
+	mavlink_message_t msg;
+	uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+
+	if (argc > 2 && (payload < 10 || payload > MAVLINK_MSG_ID_ENCAPSULATED_DATA_LEN - 7)) {
+		printf("PAYLOAD must be 10 to %d bytes\n", MAVLINK_MSG_ID_ENCAPSULATED_DATA_LEN - 7);
+		return EXIT_FAILURE;
+	}
+
+	for (uint32_t i = 0; written < target; i++) {
+		if (payload)
+			blob_pack(&msg, i, payload + 2 * (i % 8) - 7);
+		else
+			telemetry_pack(&msg, i);
+		uint16_t len = mavlink_msg_to_send_buffer(buf, &msg);
+		if (fwrite(buf, 1, len, stdout) != len) {
+			perror("fwrite()");
+			return EXIT_FAILURE;
+		}
+		written += len;
+	}
+	return EXIT_SUCCESS;
+}
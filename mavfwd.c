@@ -1,18 +1,36 @@
 // gcc -o mavfwd mavfwd.c -levent -levent_core -s
+#define _GNU_SOURCE
 #include <arpa/inet.h>
 #include <assert.h>
 #include <ctype.h>
+#include <dirent.h>
+#include <endian.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <linux/serial.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
@@ -20,12 +38,22 @@
 #include <event2/buffer.h>
 #include <event2/bufferevent.h>
 #include <event2/event.h>
+#include <event2/listener.h>
 #include <event2/util.h>
 
 #include "mavlink/common/mavlink.h"
 
 #define MAX_MTU 9000
 
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+// 0 compiles the hot path latency histograms out
+#ifndef MAVFWD_LATENCY
+#define MAVFWD_LATENCY 1
+#endif
+
 bool verbose = false;
 
 const char *default_master = "/dev/ttyAMA0";
@@ -40,17 +68,13 @@ const int RC_CHANNELS_RAW = 35;
 static uint8_t ch_count = 0;
 static uint16_t ch[14];
 static uint8_t system_id = 1;
-static unsigned long long LastWfbSent = 0;
 
 struct bufferevent *serial_bev;
-struct sockaddr_in sin_out = {
-	.sin_family = AF_INET,
-};
-
 int out_sock;
 long wait_after_bash = 2000; // Time to wait between bash script starts.
 int ChannelPersistPeriodmMS = 2000; // time needed for a RC channel value to persist to execute a commands
 long aggregate = 1;
+long hold_us = 100000; // Max time a frame waits for its aggregate to fill
 
 static bool monitor_wfb = false;
 static int temp = false;
@@ -60,19 +84,47 @@ static void print_usage() {
 		"Usage: mavfwd [OPTIONS]\n"
 		"Where:\n"
 		"  -m --master      Local MAVLink master port (%s by default)\n"
-		"  -b --baudrate    Serial port baudrate (%d by default)\n"
-		"  -o --out         Remote output port (%s by default)\n"
+		"  -b --baudrate    Serial port baudrate (%d by default), any rate from 50 the UART can do\n"
+		"  -F --rtscts      RTS/CTS hardware flow control on the serial port\n"
+		"  -L --low-latency Set the serial driver's low latency mode (ASYNC_LOW_LATENCY)\n"
+		"  -B --read-batch  Wake up once BYTES (up to 64) are read, BYTES[,US], leftovers are read\n"
+		"                   after US without a read (twice the wire time of BYTES by default)\n"
+		"  -R --rt-reader   Read the serial port in a thread of its own, PRIO[,CPU]: SCHED_FIFO\n"
+		"                   priority (0 normal scheduling) and the CPU to pin it to\n"
+		"  -o --out         Remote output port (%s by default), repeat for more endpoints.\n"
+		"                   Per endpoint options: host:port[,allow=IDS][,deny=IDS][,agg=N][,rate=BYTES]\n"
+		"                   [,pack][,fec=K/N[/MS]] IDS is a list of msgids and ranges like\n"
+		"                   0/30/100-200, agg overrides -a, rate caps the endpoint at BYTES per\n"
+		"                   second, pack compresses its datagrams into envelopes and fec adds N-K\n"
+		"                   parity datagrams to every K (sent after MS, 50 by default, if fewer),\n"
+		"                   both for a --decode on the ground\n"
 		"  -i --in          Remote input port (%s by default)\n"
 		"  -c --channels    RC Channel to listen for commands (0 by default) and call channels.sh\n"
 		"  -w --wait        Delay after each command received(2000ms default)\n"
 		"  -p --persist     How long a channel value must persist to generate a command (0ms default)\n"
 		"  -a --aggregate   Aggregate packets in frames (1 no aggregation, 0 raw data forward, %ld by default)\n"
+		"  -l --hold        Max time in microseconds a packet waits to be aggregated (%ld by default, 0 no limit)\n"
+		"  -q --class       Priority class policy: critical|osd|bulk:[agg=N][,hold=US][,budget=BYTES][,ids=IDS]\n"
+		"  -r --limit       Cap a message rate, MSGID:HZ[:drop] (latest wins unless drop), repeatable\n"
+		"  -u --uplink-queue Bound of the serial output queue, BYTES[,MS] (half a second of the\n"
+		"                   baudrate and 1000ms by default), commands and RC override are never dropped\n"
+		"  -s --stats       Unix socket serving the statistics as JSON to each client\n"
+		"  -S --stats-shm   File (e.g. /dev/shm/mavfwd) mapped as a seqlock-protected statistics page\n"
+		"  -T --record      Record the frames of both directions in a ring file of .tlog records,\n"
+		"                   FILE[,KB] (4096KB by default), e.g. /tmp/mavfwd.rec\n"
+		"  -P --replay      Replay a .tlog or --record file as the serial input, instead of --master\n"
+		"  -U --replay-udp  Replay a .tlog or --record file as datagrams received on --in\n"
+		"  -X --replay-speed Pace of the replays, times the recorded one (1 by default, 0 no pacing)\n"
+		"  -K --sign        Sign the output frames and only pass signed uplink frames, FILE[,LINK]\n"
+		"                   with the 32 byte key in FILE (raw or hex) and the link id (0 by default)\n"
+		"  -D --decode      Ground side: rebuild the lost fec datagrams and expand the envelopes\n"
+		"                   received on --in for the --out ports, no serial port\n"
 		"  -f --folder      Folder for file mavlink.msg (default is current folder)\n"
 		"  -t --temp        Inject SoC temperature into telemetry\n"
 		"  -d --wfb         Monitors wfb.log file and reports errors via mavlink HUD messages\n"
 		"  -v --verbose     Display each packet, default not\n"
 		"  --help           Display this help\n",
-		default_master, default_baudrate, default_out_addr, default_in_addr, aggregate);
+		default_master, default_baudrate, default_out_addr, default_in_addr, aggregate, hold_us);
 }
 
 static speed_t speed_by_value(int baudrate) {
@@ -95,11 +147,24 @@ static speed_t speed_by_value(int baudrate) {
 		return B500000;
 	case 921600:
 		return B921600;
+	case 1000000:
+		return B1000000;
+	case 1152000:
+		return B1152000;
 	case 1500000:
 		return B1500000;
+	case 2000000:
+		return B2000000;
+	case 2500000:
+		return B2500000;
+	case 3000000:
+		return B3000000;
+	case 3500000:
+		return B3500000;
+	case 4000000:
+		return B4000000;
 	default:
-		printf("Not implemented baudrate %d\n", baudrate);
-		exit(EXIT_FAILURE);
+		return 0; // not a standard rate, set with BOTHER
 	}
 }
 
@@ -110,13 +175,26 @@ uint64_t get_current_time_ms() {
 	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
 }
 
+static uint64_t get_current_time_us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static uint64_t get_current_time_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 static bool parse_host_port(const char *s, struct in_addr *out_addr, in_port_t *out_port) {
 	char host_and_port[32] = {0};
 	strncpy(host_and_port, s, sizeof(host_and_port) - 1);
 
 	char *colon = strchr(host_and_port, ':');
 	if (NULL == colon) {
-		return -1;
+		printf("Cannot parse `%s', expected host:port.\n", s);
+		return false;
 	}
 
 	*colon = '\0';
@@ -146,564 +224,4798 @@ static void signal_cb(evutil_socket_t fd, short event, void *arg) {
 	event_base_loopbreak(base);
 }
 
-static void send_msg_to_groundstation(const char *msg_buf) {
-	mavlink_message_t message;
-	mavlink_msg_statustext_pack_chan(system_id,
-		MAV_COMP_ID_SYSTEM_CONTROL, MAVLINK_COMM_1, &message, 4, msg_buf, 0, 0);
+/* Shared frames.
+ *
+ * A frame read from the serial port, or generated here, is copied once into a
+ * pool slot. Endpoint queues and the egress queue hold references to the slot
+ * instead of copies, it goes back to the free list with the last reference.
+ */
+#define FRAME_POOL_SIZE 1280
+
+struct frame_ref {
+	struct frame_ref *next_free;
+	uint32_t msgid;
+	uint16_t len;
+	uint16_t refs;
+	uint8_t cls; // priority class
+	bool sign;	   // signed flag and length set, each output adds its own signature
+	uint8_t data[MAVLINK_MAX_PACKET_LEN];
+#if MAVFWD_LATENCY
+	uint64_t read_ns; // start of the serial read that completed the frame, 0 if not from serial
+	uint64_t frame_ns;
+	uint64_t queue_ns;
+#endif
+};
 
-	uint8_t buffer[MAVLINK_MAX_PACKET_LEN];
-	int len = mavlink_msg_to_send_buffer(buffer, &message);
-	sendto(out_sock, buffer, len, 0, (struct sockaddr *)&sin_out, sizeof(sin_out));
-}
+static struct {
+	struct frame_ref slots[FRAME_POOL_SIZE];
+	struct frame_ref *free;
+	bool ready;
+	unsigned long exhausted;
+} frame_pool;
+
+static void egress_flush();
+static void signing_seal(const struct frame_ref *f, uint8_t *sig);
+
+/// @brief Takes a free slot with one reference, NULL if the pool is exhausted
+static struct frame_ref *frame_alloc() {
+	if (!frame_pool.ready) {
+		for (int i = FRAME_POOL_SIZE - 1; i >= 0; i--) {
+			frame_pool.slots[i].next_free = frame_pool.free;
+			frame_pool.free = &frame_pool.slots[i];
+		}
+		frame_pool.ready = true;
+	}
+	// Slots waiting to be sent are released by a flush
+	if (!frame_pool.free)
+		egress_flush();
 
-static void dump_mavlink_packet(unsigned char *data, const char *direction) {
-	uint8_t seq;
-	uint8_t sys_id;
-	uint8_t comp_id;
-	uint32_t msg_id;
+	struct frame_ref *f = frame_pool.free;
+	if (!f) {
+		frame_pool.exhausted++;
+		return NULL;
+	}
+	frame_pool.free = f->next_free;
+	f->refs = 1;
+	f->sign = false;
+#if MAVFWD_LATENCY
+	f->read_ns = 0;
+#endif
+	return f;
+}
 
-	if (data[0] == 0xFE) { // mavlink 1
-		seq = data[2];
-		sys_id = data[3];
-		comp_id = data[4];
-		msg_id = data[5];
-	} else if (data[0] == 0xFD) { // mavlink 2
-		seq = data[4];
-		sys_id = data[5];
-		comp_id = data[6];
-		msg_id = data[7];
+static void frame_release(struct frame_ref *f) {
+	if (--f->refs == 0) {
+		f->next_free = frame_pool.free;
+		frame_pool.free = f;
 	}
+}
 
-	if (verbose)
-		printf("%s %#02x sender %d/%d\t%d\t%d\n", direction, data[0], sys_id, comp_id, seq, msg_id);
+static struct frame_ref *frame_from_buffer(const uint8_t *data, size_t len, uint32_t msgid) {
+	if (len > MAVLINK_MAX_PACKET_LEN)
+		return NULL;
+	struct frame_ref *f = frame_alloc();
+	if (f) {
+		memcpy(f->data, data, len);
+		f->len = len;
+		f->msgid = msgid;
+	}
+	return f;
+}
 
-	uint16_t val;
-	if ((msg_id == RC_CHANNELS || msg_id == RC_CHANNELS_RAW) && ch_count > 0) {
-		uint8_t offset = 18; // 15 = 1ch;
-		for (uint8_t i = 0; i < ch_count; i++) {
-			val = data[offset] | (data[offset + 1] << 8);
-			if (ch[i] != val) {
-				ch[i] = val;
-				char buffer[44];
-				sprintf(buffer, "channels.sh %d %d &", i + 5, val);
-				system(buffer);
-				if (verbose)
-					printf("called channels.sh %d %d\n", i + 5, val);
-			}
-			offset = offset + 2;
-		} // for
-	}	  // msg_id
+/// @brief Copies the frame as it goes out, a frame signed here gets a signature of its own
+static void frame_copy(const struct frame_ref *f, uint8_t *out) {
+	if (!f->sign) {
+		memcpy(out, f->data, f->len);
+		return;
+	}
+	size_t len = f->len - MAVLINK_SIGNATURE_BLOCK_LEN;
+	memcpy(out, f->data, len);
+	signing_seal(f, out + len);
 }
 
-/* https://discuss.ardupilot.org/uploads/short-url/vS0JJd3BQfN9uF4DkY7bAeb6Svd.pdf
- * 0. Message header, always 0xFE
- * 1. Message length
- * 2. Sequence number -- rolls around from 255 to 0 (0x4e, previous was 0x4d)
- * 3. System ID - what system is sending this message
- * 4. Component ID- what component of the system is sending the message
- * 5. Message ID (e.g. 0 = heartbeat and many more! Don’t be shy, you can add too..)
+/* Egress queue.
+ *
+ * Datagrams produced while handling one event-loop iteration are collected
+ * here and sent with a single sendmmsg() by an event that is activated with
+ * the first datagram, so it runs after the other callbacks of the iteration.
+ * Raw-mode chunks for the same destination are coalesced and, when the kernel
+ * supports UDP GSO, sent as one UDP_SEGMENT message the kernel splits up.
+ * Aggregated frames are not copied, each one is an iovec of a gathered
+ * message that points into a shared frame slot held until the flush.
  */
-static bool get_mavlink_packet(unsigned char *in_buffer, int buf_len, int *packet_len) {
-	if (buf_len < 6 /* header */) {
-		return false;
+#define EGRESS_MAX_MSGS 64
+#define EGRESS_MAX_IOVS 512
+#define EGRESS_ARENA_SIZE (64 * 1024)
+#define EGRESS_GSO_SEGMENT 1024
+#define EGRESS_GSO_MAX_SEGS 32
+#define EGRESS_SIZE_BUCKETS 10 // datagram sizes <64B, <128B ... >=16KB
+
+static struct {
+	uint8_t arena[EGRESS_ARENA_SIZE];
+	size_t used;
+	struct mmsghdr msgs[EGRESS_MAX_MSGS];
+	struct iovec iov[EGRESS_MAX_IOVS];
+	int iov_used;
+	struct frame_ref *held[EGRESS_MAX_IOVS];
+	int held_count;
+	struct sockaddr_in dst[EGRESS_MAX_MSGS];
+	char cmsg[EGRESS_MAX_MSGS][CMSG_SPACE(sizeof(uint16_t))];
+	bool stream[EGRESS_MAX_MSGS]; // raw-mode data that may be coalesced and segmented
+	int count;
+	struct event *flush_ev;
+	bool gso;
+
+	unsigned long datagrams;
+	unsigned long syscalls;
+	unsigned long errors;
+	unsigned long sizes[EGRESS_SIZE_BUCKETS];
+} egress;
+
+static void endpoint_send_error(const struct sockaddr_in *dst);
+static void latency_sent(struct frame_ref *const *frames, int count);
+
+static void egress_flush_cb(evutil_socket_t fd, short event, void *arg) {
+	(void)fd;
+	(void)event;
+	(void)arg;
+	egress_flush();
+}
+
+static void egress_init(struct event_base *base) {
+	egress.flush_ev = event_new(base, -1, 0, egress_flush_cb, NULL);
+
+	// Probe for UDP GSO (Linux 4.18+), the segment size itself goes in each message's cmsg
+	int seg = EGRESS_GSO_SEGMENT;
+	egress.gso = setsockopt(out_sock, SOL_UDP, UDP_SEGMENT, &seg, sizeof(seg)) == 0;
+	if (egress.gso) {
+		seg = 0;
+		setsockopt(out_sock, SOL_UDP, UDP_SEGMENT, &seg, sizeof(seg));
 	}
-	assert(in_buffer[0] == 0xFE || in_buffer[0] == 0xFD); // mavlink 1 or 2
+	if (verbose)
+		printf("UDP GSO %s\n", egress.gso ? "available" : "not available");
+}
 
-	uint8_t msg_len = in_buffer[1];
-	if (in_buffer[0] == 0xFE)
-		*packet_len = 6 /* header */ + msg_len + 2 /* crc */; // mavlink 1
-	else
-		*packet_len = 10 /* header */ + msg_len + 2 /* crc */; // mavlink 2
-	if (buf_len < *packet_len)
-		return false;
+// Adds a message made of the next iovlen iovecs, the caller checked there is room
+static struct iovec *egress_add(const struct sockaddr_in *dst, int iovlen, bool stream) {
+	int i = egress.count++;
+	struct iovec *iov = &egress.iov[egress.iov_used];
+	egress.iov_used += iovlen;
+	egress.dst[i] = *dst;
+	egress.stream[i] = stream;
+	egress.msgs[i].msg_hdr = (struct msghdr){
+		.msg_name = &egress.dst[i],
+		.msg_namelen = sizeof(egress.dst[i]),
+		.msg_iov = iov,
+		.msg_iovlen = iovlen,
+	};
 
-	dump_mavlink_packet(in_buffer, ">>");
+	if (egress.count == 1 && egress.flush_ev)
+		event_active(egress.flush_ev, 0, 0);
+	return iov;
+}
 
-	return true;
+// Reserves a message slot with len bytes of arena, flushing first if the queue is full
+static uint8_t *egress_reserve(const struct sockaddr_in *dst, size_t len, bool stream) {
+	if (len > EGRESS_ARENA_SIZE)
+		return NULL;
+	if (egress.count == EGRESS_MAX_MSGS || egress.iov_used == EGRESS_MAX_IOVS ||
+		egress.used + len > EGRESS_ARENA_SIZE)
+		egress_flush();
+
+	uint8_t *buf = egress.arena + egress.used;
+	egress.used += len;
+	struct iovec *iov = egress_add(dst, 1, stream);
+	iov->iov_base = buf;
+	iov->iov_len = len;
+	return buf;
 }
 
-// Returns num bytes before first occurrence of 0xFE or full data length
-static size_t until_first_fe(unsigned char *data, size_t len) {
-	for (size_t i = 1; i < len; i++) {
-		if (data[i] == 0xFE || data[i] == 0xFD) {
-			return i;
+/// @brief Queues one datagram gathered from shared frames, they are held until it is sent
+///
+/// The signature of a frame signed here is made now, in the arena, and follows
+/// the frame as an iovec of its own.
+static void egress_send_frames(const struct sockaddr_in *dst, struct frame_ref *const *frames,
+	int count) {
+	int iovlen = count;
+	for (int i = 0; i < count; i++)
+		iovlen += frames[i]->sign;
+	size_t sigs = (iovlen - count) * MAVLINK_SIGNATURE_BLOCK_LEN;
+	if (count <= 0 || iovlen > EGRESS_MAX_IOVS)
+		return;
+	if (egress.count == EGRESS_MAX_MSGS || egress.iov_used + iovlen > EGRESS_MAX_IOVS ||
+		egress.used + sigs > EGRESS_ARENA_SIZE)
+		egress_flush();
+
+	struct iovec *iov = egress_add(dst, iovlen, false);
+	for (int i = 0; i < count; i++) {
+		struct frame_ref *f = frames[i];
+		iov->iov_base = f->data;
+		iov++->iov_len = f->len - (f->sign ? MAVLINK_SIGNATURE_BLOCK_LEN : 0);
+		if (f->sign) {
+			iov->iov_base = egress.arena + egress.used;
+			iov++->iov_len = MAVLINK_SIGNATURE_BLOCK_LEN;
+			signing_seal(f, egress.arena + egress.used);
+			egress.used += MAVLINK_SIGNATURE_BLOCK_LEN;
 		}
+		f->refs++;
+		egress.held[egress.held_count++] = f;
 	}
-	return len;
 }
 
-#define MAX_BUFFER_SIZE 50 // Limited by mavlink
-
-static char MavLinkMsgFile[128] = "mavlink.msg";
-static char WfbLogFile[128] = "wfb.log";
+/// @brief Holds frames copied into a queued datagram, for their send time in the latency histograms
+static void egress_hold(struct frame_ref *const *frames, int count) {
+	if (egress.held_count + count > EGRESS_MAX_IOVS)
+		egress_flush();
+	for (int i = 0; i < count && egress.held_count < EGRESS_MAX_IOVS; i++) {
+		frames[i]->refs++;
+		egress.held[egress.held_count++] = frames[i];
+	}
+}
 
-bool Check4MavlinkMsg(char *buffer) {
-	// const char *filename = MavLinkMsgFile;//"mavlink.msg";
-	FILE *file = fopen(MavLinkMsgFile, "rb");
-	if (file == NULL) // No file, no problem
-		return false;
+/// @brief Queues raw-mode data whose datagram boundaries don't matter
+static void egress_send_stream(const struct sockaddr_in *dst, const void *data, size_t len) {
+	int last = egress.count - 1;
+	if (egress.gso && last >= 0 && egress.stream[last] &&
+		egress.dst[last].sin_addr.s_addr == dst->sin_addr.s_addr &&
+		egress.dst[last].sin_port == dst->sin_port &&
+		egress.msgs[last].msg_hdr.msg_iov->iov_len + len <=
+			EGRESS_GSO_SEGMENT * EGRESS_GSO_MAX_SEGS &&
+		egress.used + len <= EGRESS_ARENA_SIZE) {
+		// The last message ends at the top of the arena, grow it
+		memcpy(egress.arena + egress.used, data, len);
+		egress.used += len;
+		egress.msgs[last].msg_hdr.msg_iov->iov_len += len;
+		return;
+	}
+	uint8_t *buf = egress_reserve(dst, len, true);
+	if (buf)
+		memcpy(buf, data, len);
+}
 
-	size_t bytesRead = fread(buffer, 1, MAX_BUFFER_SIZE, file);
-	fclose(file);
+static void egress_count_size(size_t len) {
+	int bucket = len < 64 ? 0 : 63 - __builtin_clzll(len) - 5;
+	egress.sizes[bucket < EGRESS_SIZE_BUCKETS ? bucket : EGRESS_SIZE_BUCKETS - 1]++;
+}
 
-	if (bytesRead > 0) {
-		if (verbose)
-			printf("Mavlink msg from file:%s\n", buffer);
-		if (remove(MavLinkMsgFile) != 0)
-			printf("Error deleting file");
-		return true;
-	} else
-		printf("Mavlink empty file ?!\n");
+// Counts the datagrams of a sent message and their sizes
+static unsigned egress_datagrams(int i) {
+	const struct msghdr *mh = &egress.msgs[i].msg_hdr;
+	if (mh->msg_controllen == 0) {
+		size_t len = 0;
+		for (size_t k = 0; k < mh->msg_iovlen; k++)
+			len += mh->msg_iov[k].iov_len;
+		egress_count_size(len);
+		return 1;
+	}
 
-	return false;
+	size_t len = mh->msg_iov->iov_len;
+	unsigned segs = (len + EGRESS_GSO_SEGMENT - 1) / EGRESS_GSO_SEGMENT;
+	egress.sizes[63 - __builtin_clzll(EGRESS_GSO_SEGMENT) - 5] += segs - 1;
+	egress_count_size(len - (segs - 1) * EGRESS_GSO_SEGMENT);
+	return segs;
 }
 
-/// @brief wfb_tx output should be redirected to wfb.log. Parse it and extracted dropped packets!
-/// @return
-static bool SendWfbLogToGround() {
-	if (!monitor_wfb)
-		return false;
-	if (abs(get_current_time_ms() - LastWfbSent) < 1000) // Once a second max
-		return false;
-
-	LastWfbSent = abs(get_current_time_ms());
+static void egress_flush() {
+	int sent = 0;
 
-	char msg_buf[200];
+	if (egress.count == 0)
+		return;
 
-	FILE *file = fopen(WfbLogFile, "r");
-	if (file == NULL) {
-		if (verbose)
-			printf("No file %s\n", WfbLogFile);
-		return false;
+	for (int i = 0; i < egress.count; i++) {
+		struct msghdr *mh = &egress.msgs[i].msg_hdr;
+		mh->msg_control = NULL;
+		mh->msg_controllen = 0;
+		if (egress.gso && egress.stream[i] && mh->msg_iov->iov_len > EGRESS_GSO_SEGMENT) {
+			mh->msg_control = egress.cmsg[i];
+			mh->msg_controllen = sizeof(egress.cmsg[i]);
+			struct cmsghdr *cm = CMSG_FIRSTHDR(mh);
+			cm->cmsg_level = SOL_UDP;
+			cm->cmsg_type = UDP_SEGMENT;
+			cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+			*(uint16_t *)CMSG_DATA(cm) = EGRESS_GSO_SEGMENT;
+		}
 	}
 
-	char buff[200];
-	int total_dropped_packets = 0;
-
-	/*
-	UDP rxq overflow: 2 packets dropped
-	UDP rxq overflow: 45 packets dropped
-	*/
-	if (verbose)
-		printf("Parsing file: %s\n", WfbLogFile);
+	while (sent < egress.count) {
+		int ret = sendmmsg(out_sock, &egress.msgs[sent], egress.count - sent, 0);
+		egress.syscalls++;
+		if (ret > 0) {
+			for (int i = sent; i < sent + ret; i++)
+				egress.datagrams += egress_datagrams(i);
+			sent += ret;
+			continue;
+		}
 
-	int maxlinestoparse = 0;
-	// Read lines from the file and parse for dropped packets
-	while (fgets(buff, sizeof(buff), file) != NULL) {
-		// If the file is very long, no need to struggle
-		if ((maxlinestoparse++) > 30) {
-			total_dropped_packets = 9999;
-			break;
-		}
-		// Check if the line contains "packets dropped"
-		if (strstr(buff, "packets dropped") != NULL) {
-			// split by space, Parse the line to extract the number of dropped packets
-			char *token = strtok(buff, " ");
-			while (token != NULL) {
-				if (isdigit(token[0])) {
-					int dropped_packets = atoi(token);
-					total_dropped_packets += dropped_packets;
-					break;
+		// The message at sent failed, report it and carry on with the rest
+		struct msghdr *mh = &egress.msgs[sent].msg_hdr;
+		if (mh->msg_controllen && (errno == EIO || errno == EINVAL)) {
+			// GSO refused (e.g. no checksum offload on the route), segment here from now on
+			printf("UDP GSO send failed, disabling it\n");
+			egress.gso = false;
+			uint8_t *p = mh->msg_iov->iov_base;
+			size_t left = mh->msg_iov->iov_len;
+			while (left > 0) {
+				size_t seg = left < EGRESS_GSO_SEGMENT ? left : EGRESS_GSO_SEGMENT;
+				egress.syscalls++;
+				if (sendto(out_sock, p, seg, 0, mh->msg_name, mh->msg_namelen) < 0) {
+					egress.errors++;
+					endpoint_send_error(mh->msg_name);
+				} else {
+					egress.datagrams++;
+					egress_count_size(seg);
 				}
-
-				token = strtok(NULL, " ");
+				p += seg;
+				left -= seg;
 			}
+		} else {
+			perror("sendmmsg()");
+			egress.errors++;
+			endpoint_send_error(mh->msg_name);
 		}
+		sent++;
 	}
 
-	fclose(file);
+	latency_sent(egress.held, egress.held_count);
+	for (int i = 0; i < egress.held_count; i++)
+		frame_release(egress.held[i]);
+	egress.held_count = 0;
+	egress.count = 0;
+	egress.used = 0;
+	egress.iov_used = 0;
+}
 
-	// file was empty
-	if (maxlinestoparse == 0 && total_dropped_packets == 0)
-		return false;
+/* Envelopes.
+ *
+ * An endpoint with the pack option sends each datagram in an envelope: a
+ * small header and the frames compressed with an LZ77 codec in the LZ4 block
+ * format, whose window starts with a built-in dictionary of typical telemetry
+ * frames. The frames of a datagram repeat their headers and much of their
+ * payload, and the dictionary gives even a lone frame something to match.
+ * Every envelope stands on its own, a lost datagram costs no more than
+ * before. A datagram that doesn't shrink is stored as it is. mavfwd --decode
+ * on the ground expands the envelopes back into plain MAVLink for the GCS.
+ *
+ * Header: ENVELOPE_MAGIC, version << 4 | flags, length of the datagram (LE16).
+ */
+#define ENVELOPE_MAGIC 0xA7
+#define ENVELOPE_VERSION 1
+#define ENVELOPE_LZ 0x01 // the body is compressed, else stored
+#define ENVELOPE_HEADER_LEN 4
+#define ENVELOPE_MAX_LEN 4096 // of a datagram
+#define ENVELOPE_MIN_MATCH 4
+#define ENVELOPE_HASH_BITS 11
+
+// HEARTBEAT, ATTITUDE, GLOBAL_POSITION_INT, VFR_HUD, GPS_RAW_INT and the rest of
+// an ArduPilot stream, system 1 component 1, the most frequent ones last
+static const uint8_t envelope_dict[] = {
+	0xfd, 0x33, 0x00, 0x00, 0x00, 0x01, 0x01, 0xfd, 0x00, 0x00, 0x06, 0x50,
+	0x72, 0x65, 0x41, 0x72, 0x6d, 0x3a, 0x20, 0x00, 0x53, 0x45, 0x52, 0x49,
+	0x41, 0x4c, 0x31, 0x5f, 0x42, 0x41, 0x55, 0x44, 0x00, 0x25, 0x64, 0x20,
+	0x62, 0x79, 0x74, 0x65, 0x73, 0x0a, 0x00, 0x00, 0x00, 0x00, 0x00, 0x64,
+	0x42, 0xcd, 0xcc, 0xcc, 0x3d, 0xcd, 0x4c, 0x7d, 0x44, 0x00, 0x00, 0x00,
+	0xbf, 0x29, 0x98, 0xfd, 0x0a, 0x00, 0x00, 0x00, 0x01, 0x01, 0x4d, 0x00,
+	0x00, 0x90, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0xbe, 0x65,
+	0x43, 0xfd, 0x19, 0x00, 0x00, 0x00, 0x01, 0x01, 0x16, 0x00, 0x00, 0x00,
+	0x00, 0x64, 0x42, 0x84, 0x03, 0x0c, 0x00, 0x53, 0x45, 0x52, 0x49, 0x41,
+	0x4c, 0x31, 0x5f, 0x42, 0x41, 0x55, 0x44, 0x00, 0x25, 0x64, 0x20, 0x09,
+	0x1e, 0xd3, 0xfd, 0x03, 0x00, 0x00, 0x00, 0x01, 0x01, 0x2a, 0x00, 0x00,
+	0x01, 0x00, 0x05, 0xf2, 0xb4, 0xfd, 0x0b, 0x00, 0x00, 0x00, 0x01, 0x01,
+	0x02, 0x00, 0x00, 0x00, 0x40, 0x1e, 0x18, 0x24, 0x0a, 0x06, 0x00, 0x40,
+	0xe2, 0x01, 0x03, 0x61, 0xfd, 0x0d, 0x00, 0x00, 0x00, 0x01, 0x01, 0x6f,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x08, 0x1a,
+	0x99, 0xbe, 0x1c, 0x44, 0xc3, 0xfd, 0x05, 0x00, 0x00, 0x00, 0x01, 0x01,
+	0x7d, 0x00, 0x00, 0x88, 0x13, 0xec, 0x13, 0x03, 0x08, 0xa8, 0xfd, 0x24,
+	0x00, 0x00, 0x00, 0x01, 0x01, 0x93, 0x00, 0x00, 0xf4, 0x01, 0x00, 0x00,
+	0xd0, 0x07, 0x00, 0x00, 0x80, 0x0c, 0x04, 0x10, 0x04, 0x10, 0x04, 0x10,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xe8, 0x03, 0x00, 0x01, 0x01, 0x50, 0x74, 0x42, 0xfd, 0x07,
+	0x00, 0x00, 0x00, 0x01, 0x01, 0x6d, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0xb4, 0xaa, 0x64, 0x16, 0xf5, 0xfd, 0x0e, 0x00, 0x00, 0x00, 0x01, 0x01,
+	0x1d, 0x00, 0x00, 0x40, 0xe2, 0x01, 0x00, 0xcd, 0x4c, 0x7d, 0x44, 0xcd,
+	0xcc, 0xcc, 0x3d, 0xc4, 0x09, 0xa8, 0x24, 0xfd, 0x1d, 0x00, 0x00, 0x00,
+	0x01, 0x01, 0x1b, 0x00, 0x00, 0x15, 0xcd, 0x5b, 0x07, 0x00, 0x00, 0x00,
+	0x00, 0x0a, 0x00, 0xfb, 0xff, 0x18, 0xfc, 0x01, 0x00, 0x02, 0x00, 0x03,
+	0x00, 0xc8, 0x00, 0x64, 0x00, 0x70, 0xfe, 0x00, 0xac, 0x0d, 0xe7, 0x09,
+	0xfd, 0x19, 0x00, 0x00, 0x00, 0x01, 0x01, 0x3e, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x3f, 0x00, 0x00, 0x00, 0xbf, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x5a, 0x00, 0x5a, 0x00, 0x64, 0x4e,
+	0x4a, 0xfd, 0x14, 0x00, 0x00, 0x00, 0x01, 0x01, 0x24, 0x00, 0x00, 0x40,
+	0xe2, 0x01, 0x00, 0xdc, 0x05, 0xdc, 0x05, 0x4c, 0x04, 0xdc, 0x05, 0xe8,
+	0x03, 0xe8, 0x03, 0xe8, 0x03, 0xe8, 0x03, 0x99, 0xc4, 0xfd, 0x1f, 0x00,
+	0x00, 0x00, 0x01, 0x01, 0x01, 0x00, 0x00, 0x2f, 0xfc, 0x20, 0x32, 0x2f,
+	0xfc, 0x20, 0x32, 0x2f, 0xec, 0x20, 0x32, 0xf4, 0x01, 0x38, 0x31, 0xe8,
+	0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x50, 0xdf, 0x8a, 0xfd, 0x2a, 0x00, 0x00, 0x00, 0x01, 0x01, 0x41,
+	0x00, 0x00, 0x40, 0xe2, 0x01, 0x00, 0xdc, 0x05, 0xdc, 0x05, 0xe8, 0x03,
+	0xdc, 0x05, 0x4c, 0x04, 0xb0, 0x04, 0x14, 0x05, 0x78, 0x05, 0xdc, 0x05,
+	0x40, 0x06, 0xa4, 0x06, 0x08, 0x07, 0x6c, 0x07, 0xd0, 0x07, 0xdc, 0x05,
+	0xdc, 0x05, 0x00, 0x00, 0x00, 0x00, 0x10, 0xc8, 0xda, 0xa4, 0xfd, 0x1e,
+	0x00, 0x00, 0x00, 0x01, 0x01, 0x18, 0x00, 0x00, 0x15, 0xcd, 0x5b, 0x07,
+	0x00, 0x00, 0x00, 0x00, 0x4a, 0x52, 0x40, 0x1c, 0x43, 0xf4, 0x17, 0x05,
+	0xa0, 0x86, 0x01, 0x00, 0x64, 0x00, 0x64, 0x00, 0xf4, 0x01, 0x28, 0x23,
+	0x03, 0x0c, 0x7b, 0xc1, 0xfd, 0x13, 0x00, 0x00, 0x00, 0x01, 0x01, 0x4a,
+	0x00, 0x00, 0x00, 0x00, 0x20, 0x41, 0x00, 0x00, 0x30, 0x41, 0x00, 0x00,
+	0xc8, 0x42, 0x00, 0x00, 0x00, 0x3f, 0x5a, 0x00, 0x32, 0x5a, 0x39, 0xfd,
+	0x09, 0x00, 0x00, 0x00, 0x01, 0x01, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00,
+	0x00, 0x02, 0x03, 0x81, 0x04, 0x03, 0x9b, 0x79, 0xfd, 0x1c, 0x00, 0x00,
+	0x00, 0x01, 0x01, 0x21, 0x00, 0x00, 0x40, 0xe2, 0x01, 0x00, 0x4a, 0x52,
+	0x40, 0x1c, 0x43, 0xf4, 0x17, 0x05, 0xa0, 0x86, 0x01, 0x00, 0x50, 0xc3,
+	0x00, 0x00, 0x64, 0x00, 0x64, 0x00, 0x00, 0x00, 0x28, 0x23, 0xf6, 0x29,
+	0xfd, 0x1c, 0x00, 0x00, 0x00, 0x01, 0x01, 0x1e, 0x00, 0x00, 0x40, 0xe2,
+	0x01, 0x00, 0xcd, 0xcc, 0xcc, 0x3d, 0xcd, 0xcc, 0x4c, 0x3e, 0x9a, 0x99,
+	0x99, 0x3e, 0x0a, 0xd7, 0x23, 0x3c, 0x0a, 0xd7, 0xa3, 0x3c, 0x8f, 0xc2,
+	0xf5, 0x3c, 0x98, 0x56,
+};
 
-	// remove(WfbLogFile) // This will break console output in the file!
-	// Open the file in write mode, truncating it to zero size
-	file = fopen(WfbLogFile, "w");
-	if (file != NULL)
-		fclose(file);
+static struct {
+	uint16_t dict_table[1 << ENVELOPE_HASH_BITS]; // positions + 1, 0 for none
+	uint16_t table[1 << ENVELOPE_HASH_BITS];
+	bool ready;
+	uint8_t window[sizeof(envelope_dict) + ENVELOPE_MAX_LEN];
+} envelope;
+
+static inline uint32_t envelope_read32(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
 
-	sprintf(msg_buf, "%d video pckts dropped!\n", total_dropped_packets);
-	printf("%s", msg_buf);
-	send_msg_to_groundstation(msg_buf);
+static inline unsigned envelope_hash(const uint8_t *p) {
+	return envelope_read32(p) * 2654435761u >> (32 - ENVELOPE_HASH_BITS);
+}
+
+// Length beyond the 15 of a token nibble, in bytes of 255 and a last one below
+static uint8_t *envelope_put_len(uint8_t *op, size_t len) {
+	for (len -= 15; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = len;
+	return op;
+}
 
+static bool envelope_get_len(const uint8_t **ip, const uint8_t *end, size_t *len) {
+	uint8_t b;
+	do {
+		if (*ip == end)
+			return false;
+		b = *(*ip)++;
+		*len += b;
+	} while (b == 255);
 	return true;
 }
 
-static bool SendInfoToGround() {
-	char msg_buf[MAX_BUFFER_SIZE];
-	if (!Check4MavlinkMsg(msg_buf))
-		return false;
+/// @brief Compresses window[start, end) into out, returns the size or 0 if it isn't below limit
+static size_t envelope_lz(size_t start, size_t end, uint8_t *out, size_t limit) {
+	const uint8_t *win = envelope.window;
+	uint16_t *table = envelope.table;
+	uint8_t *op = out, *op_end = out + limit;
+	size_t anchor = start, i = start;
+
+	memcpy(table, envelope.dict_table, sizeof(envelope.table));
+	while (i + ENVELOPE_MIN_MATCH <= end) {
+		unsigned h = envelope_hash(win + i);
+		size_t cand = table[h];
+		table[h] = i + 1;
+		if (!cand-- || envelope_read32(win + cand) != envelope_read32(win + i)) {
+			i++;
+			continue;
+		}
+		size_t mlen = ENVELOPE_MIN_MATCH;
+		while (i + mlen < end && win[cand + mlen] == win[i + mlen])
+			mlen++;
+
+		size_t lits = i - anchor, off = i - cand;
+		if (op + 1 + lits / 255 + 1 + lits + 2 + mlen / 255 + 1 >= op_end)
+			return 0;
+		uint8_t *token = op++;
+		*token = (lits < 15 ? lits : 15) << 4 | (mlen - 4 < 15 ? mlen - 4 : 15);
+		if (lits >= 15)
+			op = envelope_put_len(op, lits);
+		memcpy(op, win + anchor, lits);
+		op += lits;
+		*op++ = off;
+		*op++ = off >> 8;
+		if (mlen - 4 >= 15)
+			op = envelope_put_len(op, mlen - 4);
+
+		// a later frame may match from inside this one
+		for (size_t j = i + 1; j < i + mlen && j + ENVELOPE_MIN_MATCH <= end; j++)
+			table[envelope_hash(win + j)] = j + 1;
+		i += mlen;
+		anchor = i;
+	}
 
-	send_msg_to_groundstation(msg_buf);
+	// the last sequence is literals only
+	size_t lits = end - anchor;
+	if (op + 1 + lits / 255 + 1 + lits >= op_end)
+		return 0;
+	*op++ = (lits < 15 ? lits : 15) << 4;
+	if (lits >= 15)
+		op = envelope_put_len(op, lits);
+	memcpy(op, win + anchor, lits);
+	return op + lits - out;
+}
 
-	return true;
+/// @brief Expands an LZ body after the dictionary in the window, returns its length or -1
+static ssize_t envelope_unlz(const uint8_t *in, size_t len) {
+	const uint8_t *ip = in, *end = in + len;
+	uint8_t *win = envelope.window;
+	size_t o = sizeof(envelope_dict), cap = sizeof(envelope.window);
+
+	while (ip < end) {
+		unsigned token = *ip++;
+		size_t lits = token >> 4;
+		if (lits == 15 && !envelope_get_len(&ip, end, &lits))
+			return -1;
+		if (lits > (size_t)(end - ip) || lits > cap - o)
+			return -1;
+		memcpy(win + o, ip, lits);
+		o += lits;
+		ip += lits;
+		if (ip == end)
+			break;
+
+		if (end - ip < 2)
+			return -1;
+		size_t off = ip[0] | ip[1] << 8, mlen = (token & 15) + ENVELOPE_MIN_MATCH;
+		ip += 2;
+		if ((token & 15) == 15 && !envelope_get_len(&ip, end, &mlen))
+			return -1;
+		if (off == 0 || off > o || mlen > cap - o)
+			return -1;
+		// byte by byte, a match may overlap what it produces
+		for (size_t k = 0; k < mlen; k++, o++)
+			win[o] = win[o - off];
+	}
+	return o - sizeof(envelope_dict);
 }
 
-uint64_t get_current_time_ms_Old() {
-	time_t current_time = time(NULL);
-	return (uint64_t)(current_time * 1000);
+static void envelope_init() {
+	if (envelope.ready)
+		return;
+	memcpy(envelope.window, envelope_dict, sizeof(envelope_dict));
+	for (size_t i = 0; i + ENVELOPE_MIN_MATCH <= sizeof(envelope_dict); i++)
+		envelope.dict_table[envelope_hash(envelope_dict + i)] = i + 1;
+	envelope.ready = true;
 }
 
-static float last_board_temp;
+/// @brief Puts the frames in an envelope at out, with room for them stored, returns its length
+static size_t envelope_pack(struct frame_ref *const *frames, int count, uint8_t *out) {
+	size_t start = sizeof(envelope_dict), end = start;
+	envelope_init();
+	for (int i = 0; i < count; i++) {
+		frame_copy(frames[i], envelope.window + end);
+		end += frames[i]->len;
+	}
 
-/// @brief
-/// @return -100 if no sigmastar found
-static int GetTempSigmaStar() {
-	// https://wx.comake.online/doc/doc/SigmaStarDocs-SSD220-SIGMASTAR-202305231834/platform/BSP/Ikayaki/frequency_en.html
-	FILE *file = fopen("/sys/devices/virtual/mstar/msys/TEMP_R", "r"); // Temperature 62
-	if (file == NULL) {
-		if (verbose)
-			printf("No temp data at %s\n", WfbLogFile);
-		return -100;
+	size_t len = end - start;
+	size_t body = envelope_lz(start, end, out + ENVELOPE_HEADER_LEN, len);
+	out[0] = ENVELOPE_MAGIC;
+	out[1] = ENVELOPE_VERSION << 4 | (body ? ENVELOPE_LZ : 0);
+	out[2] = len;
+	out[3] = len >> 8;
+	if (!body) {
+		memcpy(out + ENVELOPE_HEADER_LEN, envelope.window + start, len);
+		body = len;
 	}
+	return ENVELOPE_HEADER_LEN + body;
+}
 
-	last_board_temp = -100;
-	char buff[200];
-	// Read lines from the file and parse for dropped packets
-	if (fgets(buff, sizeof(buff), file) != NULL) {
-		// Find "Temperature"
-		char *temperature_str = strstr(buff, "Temperature");
-		if (temperature_str != NULL)
-			// Extract temperature value
-			last_board_temp = atoi(temperature_str + 12);
+/// @brief Opens an envelope, returns the datagram it holds and its length, or NULL if it's broken
+static const uint8_t *envelope_unpack(const uint8_t *in, size_t len, size_t *out_len) {
+	if (len < ENVELOPE_HEADER_LEN || in[0] != ENVELOPE_MAGIC || in[1] >> 4 != ENVELOPE_VERSION)
+		return NULL;
+	size_t want = in[2] | in[3] << 8;
+	if (!(in[1] & ENVELOPE_LZ)) {
+		*out_len = len - ENVELOPE_HEADER_LEN;
+		return *out_len == want ? in + ENVELOPE_HEADER_LEN : NULL;
 	}
+	envelope_init();
+	ssize_t got = envelope_unlz(in + ENVELOPE_HEADER_LEN, len - ENVELOPE_HEADER_LEN);
+	if (got < 0 || (size_t)got != want)
+		return NULL;
+	*out_len = got;
+	return envelope.window + sizeof(envelope_dict);
+}
 
-	fclose(file);
+/// @brief Queues the frames as one envelope, held until it is sent, returns its length
+///
+/// The time spent packing, without the sends a full queue triggers, is added to *ns.
+static size_t egress_send_packed(const struct sockaddr_in *dst, struct frame_ref *const *frames,
+	int count, uint64_t *ns) {
+	size_t total = 0;
+	for (int i = 0; i < count; i++)
+		total += frames[i]->len;
+	if (count <= 0 || total > ENVELOPE_MAX_LEN)
+		return 0;
 
-	if (verbose && last_board_temp < -90)
-		printf("No temp data in file %s\n", WfbLogFile);
+	uint8_t *buf = egress_reserve(dst, ENVELOPE_HEADER_LEN + total, false);
+	if (!buf)
+		return 0;
+	uint64_t start = get_current_time_ns();
+	size_t len = envelope_pack(frames, count, buf);
+	*ns += get_current_time_ns() - start;
+	// the envelope is at the top of the arena, give back what it didn't use
+	egress.used -= ENVELOPE_HEADER_LEN + total - len;
+	egress.msgs[egress.count - 1].msg_hdr.msg_iov->iov_len = len;
+	egress_hold(frames, count);
+	return len;
+}
 
-	return last_board_temp;
+/* Forward error correction.
+ *
+ * An endpoint with fec=K/N sends its datagrams in groups of K and follows each
+ * group with N-K parity datagrams, a systematic Reed-Solomon code over GF(256)
+ * with a Cauchy matrix: a mavfwd --decode on the ground rebuilds up to N-K
+ * lost datagrams of a group from any K of its N. This covers the telemetry
+ * path on its own, over wfb_tx (whose FEC is tuned for video) or plain UDP.
+ * The data datagrams go out at once, with a small header; the parity of a
+ * group that didn't fill up within its hold time covers the datagrams it has.
+ *
+ * Header: FEC_MAGIC, version << 4, group (LE16), index (data from 0, parity
+ * from FEC_PARITY), data datagrams of the group (K until the parity tells).
+ * Parity is computed over each datagram prefixed with its length (LE16) and
+ * padded with zeroes to the longest of the group.
+ */
+#define FEC_MAGIC 0xA8
+#define FEC_VERSION 1
+#define FEC_HEADER_LEN 6
+#define FEC_MAX_K 16
+#define FEC_MAX_PARITY 16
+#define FEC_PARITY 0x80 // index of the first parity datagram
+#define FEC_MAX_LEN (ENVELOPE_HEADER_LEN + 2048) // of a datagram, packed or not
+#define FEC_SHARD_LEN (2 + FEC_MAX_LEN)
+#define FEC_HOLD_MS 50
+#define FEC_GROUPS 8 // being decoded at once
+
+static uint8_t gf_exp[512];
+static uint8_t gf_log[256];
+
+static void gf_init() {
+	if (gf_exp[0])
+		return;
+	unsigned x = 1;
+	for (int i = 0; i < 255; i++) {
+		gf_exp[i] = gf_exp[i + 255] = x;
+		gf_log[x] = i;
+		x <<= 1;
+		if (x & 0x100)
+			x ^= 0x11D; // x^8 + x^4 + x^3 + x^2 + 1
+	}
 }
 
-static uint64_t LastTempSent;
+static inline uint8_t gf_mul(uint8_t a, uint8_t b) {
+	return a && b ? gf_exp[gf_log[a] + gf_log[b]] : 0;
+}
 
-static int SendTempToGround(unsigned char *mavbuf) {
-	// Once a second
-	if (abs(get_current_time_ms() - LastTempSent) < 1000)
-		return 0;
+static inline uint8_t gf_inv(uint8_t a) { return gf_exp[255 - gf_log[a]]; }
 
-	LastTempSent = abs(get_current_time_ms());
+// dst += c * src
+static void gf_mul_add(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len) {
+	if (c == 0)
+		return;
+	const uint8_t *row = gf_exp + gf_log[c];
+	for (size_t i = 0; i < len; i++)
+		if (src[i])
+			dst[i] ^= row[gf_log[src[i]]];
+}
 
-	// read the temperature only once per second
-	if (temp == 2)
-		last_board_temp = GetTempSigmaStar();
+// Coefficient of data datagram i in parity datagram j, 1 / (x_j + y_i) with disjoint x and y
+static inline uint8_t fec_coef(unsigned j, unsigned i) { return gf_inv((FEC_MAX_K + j) ^ i); }
+
+struct fec_encoder {
+	uint8_t k, n;
+	long hold_ms;
+	struct sockaddr_in dst;
+	struct event *timer;
+
+	uint16_t group;
+	uint8_t count;
+	uint8_t shards[FEC_MAX_K][FEC_SHARD_LEN]; // length and datagram
+
+	unsigned long groups;
+	unsigned long early; // groups sent before they were full
+	unsigned long data;
+	unsigned long parity;
+	unsigned long parity_bytes;
+	uint64_t ns;
+};
 
-	mavlink_message_t message;
-	mavlink_msg_raw_imu_pack_chan(system_id, MAV_COMP_ID_SYSTEM_CONTROL, MAVLINK_COMM_1, &message,
-		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, last_board_temp * 100);
+/// @brief Parses "K/N[/MS]", NULL on error
+static struct fec_encoder *fec_encoder_new(const char *spec, const struct sockaddr_in *dst) {
+	int k, n, end = 0;
+	long hold_ms = FEC_HOLD_MS;
+	if (sscanf(spec, "%d/%d%n/%ld%n", &k, &n, &end, &hold_ms, &end) < 2 || spec[end] ||
+		hold_ms < 0 || k < 1 || k > FEC_MAX_K || n <= k || n - k > FEC_MAX_PARITY)
+		return NULL;
 
-	return mavlink_msg_to_send_buffer(mavbuf, &message);
+	struct fec_encoder *enc = calloc(1, sizeof(*enc));
+	if (!enc)
+		return NULL;
+	enc->k = k;
+	enc->n = n;
+	enc->hold_ms = hold_ms;
+	enc->dst = *dst;
+	gf_init();
+	return enc;
 }
 
-bool version_shown = false;
-static void ShowVersionOnce(mavlink_message_t *msg, uint8_t header) {
-	if (version_shown)
+static void fec_header(uint8_t *buf, uint16_t group, uint8_t index, uint8_t k) {
+	buf[0] = FEC_MAGIC;
+	buf[1] = FEC_VERSION << 4;
+	buf[2] = group;
+	buf[3] = group >> 8;
+	buf[4] = index;
+	buf[5] = k;
+}
+
+/// @brief Sends the parity of the group so far and starts the next one
+static void fec_close_group(struct fec_encoder *enc) {
+	if (enc->count == 0)
 		return;
+	if (enc->timer)
+		evtimer_del(enc->timer);
+
+	uint64_t start = get_current_time_ns();
+	size_t shard_len = 0;
+	for (int i = 0; i < enc->count; i++) {
+		size_t len = 2 + (enc->shards[i][0] | enc->shards[i][1] << 8);
+		if (len > shard_len)
+			shard_len = len;
+	}
+	for (int j = 0; j < enc->n - enc->k; j++) {
+		uint8_t *buf = egress_reserve(&enc->dst, FEC_HEADER_LEN + shard_len, false);
+		if (!buf)
+			break;
+		fec_header(buf, enc->group, FEC_PARITY + j, enc->count);
+		memset(buf + FEC_HEADER_LEN, 0, shard_len);
+		for (int i = 0; i < enc->count; i++)
+			gf_mul_add(buf + FEC_HEADER_LEN, enc->shards[i], fec_coef(j, i),
+				2 + (enc->shards[i][0] | enc->shards[i][1] << 8));
+		enc->parity++;
+		enc->parity_bytes += FEC_HEADER_LEN + shard_len;
+	}
+	enc->ns += get_current_time_ns() - start;
 
-	version_shown = true;
-	/*
-	The major version can be determined from the packet start marker byte:
-	MAVLink 1: 0xFE
-	MAVLink 2: 0xFD
-	*/
-	if (header == 0xFE)
-		printf("Detected MAVLink ver: 1.0  (%d)\n", msg->magic);
-	if (header == 0xFD)
-		printf("Detected MAVLink version: 2.0  (%d)\n", msg->magic);
+	enc->groups++;
+	if (enc->count < enc->k)
+		enc->early++;
+	enc->group++;
+	enc->count = 0;
+}
 
-	printf("System_id = %d \n", system_id);
+static void fec_timer_cb(evutil_socket_t fd, short event, void *arg) {
+	(void)fd;
+	(void)event;
+	fec_close_group(arg);
 }
 
-bool fc_shown = false;
+/// @brief Room for the next datagram of the group, FEC_MAX_LEN bytes
+static uint8_t *fec_next(struct fec_encoder *enc) { return enc->shards[enc->count] + 2; }
 
-void handle_heartbeat(const mavlink_message_t *message) {
-	if (fc_shown)
+/// @brief Queues the datagram written at fec_next(), and the parity once the group is full
+static void fec_send(struct fec_encoder *enc, size_t len) {
+	uint8_t *shard = enc->shards[enc->count];
+	uint8_t *buf = egress_reserve(&enc->dst, FEC_HEADER_LEN + len, false);
+	if (!buf)
 		return;
+	fec_header(buf, enc->group, enc->count, enc->k);
+	memcpy(buf + FEC_HEADER_LEN, shard + 2, len);
+	shard[0] = len;
+	shard[1] = len >> 8;
+	enc->data++;
+
+	if (++enc->count == enc->k)
+		fec_close_group(enc);
+	else if (enc->count == 1 && enc->timer && enc->hold_ms > 0) {
+		struct timeval tv = {.tv_sec = enc->hold_ms / 1000, .tv_usec = enc->hold_ms % 1000 * 1000};
+		evtimer_add(enc->timer, &tv);
+	}
+}
 
-	fc_shown = true;
-	mavlink_heartbeat_t heartbeat;
-	mavlink_msg_heartbeat_decode(message, &heartbeat);
+static void fec_encoder_free(struct fec_encoder *enc) {
+	if (!enc)
+		return;
+	if (enc->timer)
+		event_free(enc->timer);
+	free(enc);
+}
 
-	printf("Flight Controller Type :");
+// Groups being received on the ground
+static struct fec_group {
+	bool used;
+	uint16_t id;
+	uint8_t k;		   // from the header of a parity datagram, 0 until one came
+	uint32_t received; // data datagrams, by index
+	uint32_t recovered;
+	uint8_t parity_count;
+	uint8_t parity_index[FEC_MAX_PARITY];
+	size_t parity_len;
+	uint8_t data[FEC_MAX_K][FEC_SHARD_LEN];
+	uint8_t parity[FEC_MAX_PARITY][FEC_SHARD_LEN];
+} fec_groups[FEC_GROUPS];
+
+static struct {
+	unsigned long data;
+	unsigned long parity;
+	unsigned long recovered;
+	unsigned long lost; // in groups that got parity but too little of it
+	unsigned long late; // for a group already replaced, or a duplicate
+	unsigned long broken;
+	uint64_t ns;
+} fec_decoder;
+
+static void fec_group_end(struct fec_group *g) {
+	if (g->used && g->k)
+		fec_decoder.lost += g->k - __builtin_popcount((g->received | g->recovered) &
+										((1u << g->k) - 1));
+	g->used = false;
+}
 
-	switch (heartbeat.autopilot) {
-	case MAV_AUTOPILOT_GENERIC:
-		printf("Generic/INAV");
-		break;
+// Solves the missing data datagrams from as many parity ones, returns the mask of those rebuilt
+static uint32_t fec_recover(struct fec_group *g) {
+	uint8_t missing[FEC_MAX_K], m = 0;
+	for (int i = 0; i < g->k; i++)
+		if (!((g->received | g->recovered) >> i & 1))
+			missing[m++] = i;
+	if (m == 0 || m > g->parity_count)
+		return 0;
 
-	case MAV_AUTOPILOT_ARDUPILOTMEGA:
-		printf("ArduPilot");
-		break;
+	// Take the known data out of the first m parity datagrams, what is left is C' * missing
+	static uint8_t rest[FEC_MAX_PARITY][FEC_SHARD_LEN];
+	uint8_t a[FEC_MAX_PARITY][FEC_MAX_PARITY], inv[FEC_MAX_PARITY][FEC_MAX_PARITY];
+	for (int r = 0; r < m; r++) {
+		unsigned j = g->parity_index[r];
+		memcpy(rest[r], g->parity[r], g->parity_len);
+		for (int i = 0; i < g->k; i++)
+			if (g->received >> i & 1)
+				gf_mul_add(rest[r], g->data[i], fec_coef(j, i),
+					2 + (g->data[i][0] | g->data[i][1] << 8));
+		for (int c = 0; c < m; c++) {
+			a[r][c] = fec_coef(j, missing[c]);
+			inv[r][c] = r == c;
+		}
+	}
+
+	// Gauss-Jordan, every square submatrix of a Cauchy matrix is invertible so no pivot is zero
+	for (int c = 0; c < m; c++) {
+		if (!a[c][c])
+			return 0;
+		uint8_t f = gf_inv(a[c][c]);
+		for (int x = 0; x < m; x++) {
+			a[c][x] = gf_mul(a[c][x], f);
+			inv[c][x] = gf_mul(inv[c][x], f);
+		}
+		for (int r = 0; r < m; r++) {
+			uint8_t e = a[r][c];
+			if (r == c || !e)
+				continue;
+			for (int x = 0; x < m; x++) {
+				a[r][x] ^= gf_mul(a[c][x], e);
+				inv[r][x] ^= gf_mul(inv[c][x], e);
+			}
+		}
+	}
+
+	uint32_t rebuilt = 0;
+	for (int c = 0; c < m; c++) {
+		uint8_t *d = g->data[missing[c]];
+		memset(d, 0, g->parity_len);
+		for (int r = 0; r < m; r++)
+			gf_mul_add(d, rest[r], inv[c][r], g->parity_len);
+		g->recovered |= 1u << missing[c];
+		if (2 + (d[0] | d[1] << 8) > g->parity_len)
+			fec_decoder.broken++;
+		else
+			rebuilt |= 1u << missing[c];
+	}
+	return rebuilt;
+}
+
+/// @brief Takes a datagram of an fec output, hands over its data and the data it completes
+static void fec_receive(const uint8_t *buf, size_t len, void (*deliver)(const uint8_t *, size_t)) {
+	if (len < FEC_HEADER_LEN || buf[1] >> 4 != FEC_VERSION) {
+		fec_decoder.broken++;
+		return;
+	}
+	uint16_t id = buf[2] | buf[3] << 8;
+	uint8_t index = buf[4], k = buf[5];
+	const uint8_t *body = buf + FEC_HEADER_LEN;
+	size_t body_len = len - FEC_HEADER_LEN;
+	bool parity = index >= FEC_PARITY;
+	// a parity body is a whole shard, the length of the datagram it covers comes first
+	if (k == 0 || k > FEC_MAX_K || (parity ? index - FEC_PARITY >= FEC_MAX_PARITY : index >= k) ||
+		body_len > (parity ? FEC_SHARD_LEN : FEC_MAX_LEN)) {
+		fec_decoder.broken++;
+		return;
+	}
+
+	gf_init();
+	uint64_t start = get_current_time_ns();
+	struct fec_group *g = &fec_groups[id % FEC_GROUPS];
+	if (!g->used || g->id != id) {
+		// its slot went to a newer group
+		if (g->used && (uint16_t)(id - g->id) > 0x8000) {
+			fec_decoder.late++;
+			return;
+		}
+		fec_group_end(g);
+		*g = (struct fec_group){.used = true, .id = id};
+	}
+
+	if (parity) {
+		unsigned j = index - FEC_PARITY;
+		bool dup = false;
+		for (int r = 0; r < g->parity_count; r++)
+			dup |= g->parity_index[r] == j;
+		if (dup || (g->parity_count && (g->parity_len != body_len || g->k != k))) {
+			fec_decoder.late++;
+			return;
+		}
+		fec_decoder.parity++;
+		g->k = k;
+		g->parity_len = body_len;
+		g->parity_index[g->parity_count] = j;
+		memcpy(g->parity[g->parity_count++], body, body_len);
+	} else {
+		if ((g->received | g->recovered) >> index & 1) {
+			fec_decoder.late++;
+			return;
+		}
+		fec_decoder.data++;
+		g->received |= 1u << index;
+		g->data[index][0] = body_len;
+		g->data[index][1] = body_len >> 8;
+		memcpy(g->data[index] + 2, body, body_len);
+	}
+	uint32_t rebuilt = g->k && g->parity_count ? fec_recover(g) : 0;
+	fec_decoder.ns += get_current_time_ns() - start;
+
+	if (!parity)
+		deliver(body, body_len);
+	for (int i = 0; rebuilt; i++, rebuilt >>= 1)
+		if (rebuilt & 1) {
+			fec_decoder.recovered++;
+			deliver(g->data[i] + 2, g->data[i][0] | g->data[i][1] << 8);
+		}
+}
+
+/* Signing.
+ *
+ * With --sign every frame sent to the outputs is signed with the key of the
+ * file, and an uplink frame only reaches the serial port with a valid
+ * signature and a timestamp newer than the last one of its stream (or, for a
+ * new stream, not older than a minute). Signing sets the signed flag, which
+ * the CRC covers, so the CRC is computed again; MAVLink 1 frames and unknown
+ * message ids (no CRC extra) go out unsigned. The signature block itself is
+ * made by each output as it sends the frame, the shared slot only has room
+ * for it, so that every output's timestamps grow. The hashing is done by
+ * mavlink_sha256.h, on the SHA instructions of the CPU when it has them. Raw
+ * outputs (-a 0) forward the serial bytes as they come and aren't signed.
+ */
+#define SIGNING_EPOCH_US 1420070400000000ULL // 2015-01-01, origin of the timestamps
+
+static struct {
+	bool enabled;
+	mavlink_signing_t link;
+	mavlink_signing_streams_t streams;
+
+	unsigned long signed_frames;
+	unsigned long unsignable;
+	unsigned long verified;
+	unsigned long unsigned_dropped;
+	unsigned long rejected; // bad signature, replayed or too old
+} signing = {.link.flags = MAVLINK_SIGNING_FLAG_SIGN_OUTGOING};
+
+/// @brief Reads the key from "FILE[,LINK]", 32 bytes raw or as 64 hex digits
+static bool signing_set(const char *spec) {
+	char path[256];
+	const char *comma = strrchr(spec, ',');
+	size_t len = comma ? (size_t)(comma - spec) : strlen(spec);
+	if (comma) {
+		char *end;
+		long link = strtol(comma + 1, &end, 10);
+		if (end == comma + 1 || *end || link < 0 || link > 255) {
+			printf("Cannot parse link id `%s', expected FILE[,LINK] with LINK up to 255.\n", spec);
+			return false;
+		}
+		signing.link.link_id = link;
+	}
+	snprintf(path, sizeof(path), "%.*s", (int)len, spec);
+
+	uint8_t buf[130];
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		printf("Cannot open key file %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	size_t n = fread(buf, 1, sizeof(buf), f);
+	fclose(f);
+
+	if (n == sizeof(signing.link.secret_key)) {
+		memcpy(signing.link.secret_key, buf, n);
+		signing.enabled = true;
+		return true;
+	}
+	while (n > 0 && isspace(buf[n - 1]))
+		n--;
+	size_t i = 0;
+	for (; n == 2 * sizeof(signing.link.secret_key) && i < n; i++)
+		if (!isxdigit(buf[i]))
+			break;
+	if (n != 2 * sizeof(signing.link.secret_key) || i < n) {
+		printf("Key file %s must hold 32 bytes, raw or as 64 hex digits\n", path);
+		return false;
+	}
+	for (i = 0; i < sizeof(signing.link.secret_key); i++) {
+		char hex[3] = {buf[2 * i], buf[2 * i + 1], 0};
+		signing.link.secret_key[i] = strtoul(hex, NULL, 16);
+	}
+	signing.enabled = true;
+	return true;
+}
+
+// Timestamps count 10us since 2015, and never go back
+static void signing_clock() {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	uint64_t now_us = ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+	uint64_t now = now_us > SIGNING_EPOCH_US ? (now_us - SIGNING_EPOCH_US) / 10 : 0;
+	if (now > signing.link.timestamp)
+		signing.link.timestamp = now;
+}
+
+/// @brief Makes room for the signature of the frame, unless it is signed already or can't be
+static void signing_prepare(struct frame_ref *f) {
+	uint8_t *frame = f->data;
+	if (!signing.enabled || (frame[0] == MAVLINK_STX && frame[2] & MAVLINK_IFLAG_SIGNED))
+		return;
+	const mavlink_msg_entry_t *e = mavlink_get_msg_entry(f->msgid);
+	if (frame[0] != MAVLINK_STX || !e) {
+		signing.unsignable++;
+		return;
+	}
+
+	uint8_t len = frame[1];
+	uint8_t *ck = frame + MAVLINK_NUM_HEADER_BYTES + len;
+	frame[2] |= MAVLINK_IFLAG_SIGNED;
+	uint16_t crc = crc_calculate(frame + 1, MAVLINK_CORE_HEADER_LEN + len);
+	crc_accumulate(e->crc_extra, &crc);
+	ck[0] = crc & 0xFF;
+	ck[1] = crc >> 8;
+	f->len += MAVLINK_SIGNATURE_BLOCK_LEN;
+	f->sign = true;
+}
+
+/// @brief Writes the signature block of a prepared frame as an output sends it
+///
+/// Outputs send their frames by priority class rather than in arrival order,
+/// and each output in its own order, so every send gets a fresh timestamp
+/// instead of the frame keeping one: a receiver drops any frame older than
+/// the last one of its stream.
+static void signing_seal(const struct frame_ref *f, uint8_t *sig) {
+	const uint8_t *frame = f->data;
+	const uint8_t *ck = frame + MAVLINK_NUM_HEADER_BYTES + frame[1];
+	signing_clock();
+	mavlink_sign_packet(&signing.link, sig, frame, MAVLINK_NUM_HEADER_BYTES,
+		frame + MAVLINK_NUM_HEADER_BYTES, frame[1], ck);
+	signing.signed_frames++;
+}
+
+/// @brief Whether an uplink frame may go on, it must carry a valid signature
+static bool signing_check(const uint8_t *frame, size_t len) {
+	if (!signing.enabled)
+		return true;
+	if (frame[0] != MAVLINK_STX || !(frame[2] & MAVLINK_IFLAG_SIGNED)) {
+		signing.unsigned_dropped++;
+		return false;
+	}
+
+	// mavlink_signature_check() wants it unpacked
+	mavlink_message_t msg;
+	uint8_t plen = frame[1];
+	memcpy(&msg.magic, frame, MAVLINK_NUM_HEADER_BYTES);
+	memcpy(_MAV_PAYLOAD_NON_CONST(&msg), frame + MAVLINK_NUM_HEADER_BYTES, plen);
+	memcpy(msg.ck, frame + MAVLINK_NUM_HEADER_BYTES + plen, sizeof(msg.ck));
+	memcpy(msg.signature, frame + len - MAVLINK_SIGNATURE_BLOCK_LEN, sizeof(msg.signature));
+	signing_clock();
+	if (!mavlink_signature_check(&signing.link, &signing.streams, &msg)) {
+		signing.rejected++;
+		return false;
+	}
+	signing.verified++;
+	return true;
+}
+
+static void signing_print() {
+	if (!signing.enabled)
+		return;
+	printf("Signing (%s SHA-256): %lu frames signed, %lu unsignable; uplink %lu verified, %lu "
+		   "unsigned and %lu bad or replayed dropped\n",
+		mavlink_sha256_backend_name(), signing.signed_frames, signing.unsignable,
+		signing.verified, signing.unsigned_dropped, signing.rejected);
+}
+
+/* Output endpoints.
+ *
+ * Every --out is an endpoint with its own msgid filter, aggregation policy and
+ * rate cap. A parsed frame is put in a shared slot once and each endpoint that
+ * accepts it queues a reference, the queue is flushed as one gathered datagram.
+ * Frames are sorted by msgid into priority classes, critical, OSD realtime
+ * and bulk, each with its own queue and flush policy. A datagram is built by
+ * draining the higher classes first, every class within its byte budget, so a
+ * parameter or mission download does not delay the OSD messages. A timer armed
+ * when the first frame enters an empty class queue flushes it after the hold
+ * time, so a frame is never delayed longer than that.
+ * Endpoints with aggregation 0 get the raw serial stream, unfiltered.
+ */
+#define MAX_ENDPOINTS 8
+#define ENDPOINT_MAX_RANGES 16
+#define ENDPOINT_MAX_FRAMES 64
+#define ENDPOINT_MAX_BYTES 2048
+#define HOLD_HIST_BUCKETS 12 // <128us, <256us ... >=131ms
+
+struct msgid_range {
+	uint32_t lo, hi;
+};
+
+enum { CLASS_CRITICAL, CLASS_OSD, CLASS_BULK, CLASS_COUNT };
+
+static struct frame_class {
+	const char *name;
+	long aggregate; // -1 for the endpoint's
+	long hold_us;	// -1 for the endpoint's
+	size_t budget;	// bytes of this class in one datagram, 0 for no limit
+	struct msgid_range ids[ENDPOINT_MAX_RANGES];
+	uint8_t id_count;
+} frame_classes[CLASS_COUNT] = {
+	// HEARTBEAT, COMMAND_INT/LONG/ACK, STATUSTEXT
+	{"critical", 1, -1, 0, {{0, 0}, {75, 77}, {253, 253}}, 3},
+	// everything not in another class
+	{"osd", -1, -1, 0, {}, 0},
+	// PARAM_VALUE, MISSION_ITEM..., FILE_TRANSFER_PROTOCOL, LOG_ENTRY/DATA, PARAM_EXT_VALUE
+	{"bulk", -1, -1, 512, {{22, 22}, {39, 40}, {44, 44}, {51, 51}, {73, 73}, {110, 110},
+		{118, 120}, {322, 322}}, 8},
+};
+
+struct endpoint;
+
+struct class_queue {
+	struct endpoint *ep;
+	struct frame_ref *frames[ENDPOINT_MAX_FRAMES];
+	uint64_t queued_us[ENDPOINT_MAX_FRAMES];
+	int count;
+	size_t bytes;
+	struct event *hold_ev;
+
+	unsigned long hold_hist[HOLD_HIST_BUCKETS];
+	unsigned long dropped;
+};
+
+struct endpoint {
+	char name[32];
+	struct sockaddr_in addr;
+	struct msgid_range allow[ENDPOINT_MAX_RANGES];
+	struct msgid_range deny[ENDPOINT_MAX_RANGES];
+	uint8_t allow_count;
+	uint8_t deny_count;
+	long aggregate; // -1 until set from --aggregate
+	long rate;		// bytes per second, 0 for no cap
+	long tokens; // in 1/1000 byte, a millisecond adds rate of them
+	uint64_t refill_ms;
+	long hold_us; // -1 until set from --hold
+	bool pack;	  // datagrams go in envelopes
+	struct fec_encoder *fec; // NULL without fec=
+
+	struct class_queue queues[CLASS_COUNT];
+	int queued; // frames in all the class queues
+	unsigned long deadline_flushes;
+
+	unsigned long frames;
+	unsigned long bytes;
+	unsigned long filtered;
+	unsigned long limited;
+	unsigned long errors; // failed sends
+
+	unsigned long packed; // envelopes
+	unsigned long packed_in;
+	unsigned long packed_out;
+	uint64_t pack_ns;
+};
+
+static struct endpoint endpoints[MAX_ENDPOINTS];
+static int endpoint_count = 0;
+static bool raw_endpoints = false;	  // some endpoint takes the raw stream
+static bool parsed_endpoints = false; // some endpoint takes parsed frames
+
+// Parses "ID/ID-ID/..." into ranges
+static bool parse_msgid_ranges(const char *s, struct msgid_range *out, uint8_t *count) {
+	while (*s) {
+		char *end;
+		unsigned long lo = strtoul(s, &end, 10), hi = lo;
+		if (end == s)
+			return false;
+		if (*end == '-') {
+			s = end + 1;
+			hi = strtoul(s, &end, 10);
+			if (end == s)
+				return false;
+		}
+		if (hi < lo || *count == ENDPOINT_MAX_RANGES)
+			return false;
+		out[(*count)++] = (struct msgid_range){lo, hi};
+
+		if (*end == '/')
+			end++;
+		else if (*end)
+			return false;
+		s = end;
+	}
+	return true;
+}
+
+/// @brief Adds an endpoint from
+/// "host:port[,allow=IDS][,deny=IDS][,agg=N][,rate=BYTES][,hold=US][,pack][,fec=K/N[/MS]]"
+static bool endpoint_add(const char *spec) {
+	if (endpoint_count == MAX_ENDPOINTS) {
+		printf("Too many endpoints, %d max\n", MAX_ENDPOINTS);
+		return false;
+	}
+
+	struct endpoint *ep = &endpoints[endpoint_count];
+	*ep = (struct endpoint){
+		.addr = {.sin_family = AF_INET},
+		.aggregate = -1,
+		.hold_us = -1,
+	};
+
+	char buf[256] = {0};
+	strncpy(buf, spec, sizeof(buf) - 1);
+	char *save, *opt = strtok_r(buf, ",", &save);
+	if (!opt || !parse_host_port(opt, &ep->addr.sin_addr, &ep->addr.sin_port))
+		return false;
+	snprintf(ep->name, sizeof(ep->name), "%s", opt);
+
+	while ((opt = strtok_r(NULL, ",", &save))) {
+		bool ok = false;
+		if (!strncmp(opt, "allow=", 6))
+			ok = parse_msgid_ranges(opt + 6, ep->allow, &ep->allow_count);
+		else if (!strncmp(opt, "deny=", 5))
+			ok = parse_msgid_ranges(opt + 5, ep->deny, &ep->deny_count);
+		else if (!strncmp(opt, "agg=", 4))
+			ok = (ep->aggregate = atol(opt + 4)) >= 0;
+		else if (!strncmp(opt, "rate=", 5))
+			ok = (ep->rate = atol(opt + 5)) >= 0 && ep->rate <= LONG_MAX / 1000;
+		else if (!strncmp(opt, "hold=", 5))
+			ok = (ep->hold_us = atol(opt + 5)) >= 0;
+		else if (!strcmp(opt, "pack"))
+			ok = ep->pack = true;
+		else if (!strncmp(opt, "fec=", 4))
+			ok = (ep->fec = fec_encoder_new(opt + 4, &ep->addr)) != NULL;
+		if (!ok) {
+			printf("Cannot parse endpoint option `%s'.\n", opt);
+			return false;
+		}
+	}
+	if (ep->aggregate > 2000)
+		ep->aggregate = 2000;
+
+	endpoint_count++;
+	return true;
+}
+
+static bool msgid_in(const struct msgid_range *r, int count, uint32_t msgid) {
+	for (int i = 0; i < count; i++)
+		if (msgid >= r[i].lo && msgid <= r[i].hi)
+			return true;
+	return false;
+}
+
+/// @brief Sets a class policy from "NAME:[agg=N][,hold=US][,budget=BYTES][,ids=IDS]"
+static bool frame_class_set(const char *spec) {
+	char buf[256] = {0};
+	strncpy(buf, spec, sizeof(buf) - 1);
+	char *opts = strchr(buf, ':');
+	if (opts)
+		*opts++ = '\0';
+
+	struct frame_class *fc = NULL;
+	for (int c = 0; c < CLASS_COUNT; c++)
+		if (!strcmp(buf, frame_classes[c].name))
+			fc = &frame_classes[c];
+	if (!fc) {
+		printf("Unknown class `%s', use critical, osd or bulk.\n", buf);
+		return false;
+	}
+
+	bool ids_set = false;
+	char *save, *opt = opts ? strtok_r(opts, ",", &save) : NULL;
+	for (; opt; opt = strtok_r(NULL, ",", &save)) {
+		bool ok = false;
+		if (!strncmp(opt, "agg=", 4))
+			ok = (fc->aggregate = atol(opt + 4)) >= 0;
+		else if (!strncmp(opt, "hold=", 5))
+			ok = (fc->hold_us = atol(opt + 5)) >= 0;
+		else if (!strncmp(opt, "budget=", 7)) {
+			long budget = atol(opt + 7);
+			ok = budget >= 0;
+			fc->budget = ok ? budget : 0;
+		} else if (!strncmp(opt, "ids=", 4)) {
+			// the list replaces the default one
+			if (!ids_set)
+				fc->id_count = 0;
+			ids_set = true;
+			ok = parse_msgid_ranges(opt + 4, fc->ids, &fc->id_count);
+		}
+		if (!ok) {
+			printf("Cannot parse class option `%s'.\n", opt);
+			return false;
+		}
+	}
+	if (fc->aggregate > 2000)
+		fc->aggregate = 2000;
+	return true;
+}
+
+static uint8_t msgid_class(uint32_t msgid) {
+	for (int c = 0; c < CLASS_COUNT; c++)
+		if (msgid_in(frame_classes[c].ids, frame_classes[c].id_count, msgid))
+			return c;
+	return CLASS_OSD;
+}
+
+static long class_aggregate(const struct endpoint *ep, int c) {
+	return frame_classes[c].aggregate >= 0 ? frame_classes[c].aggregate : ep->aggregate;
+}
+
+static long class_hold(const struct endpoint *ep, int c) {
+	return frame_classes[c].hold_us >= 0 ? frame_classes[c].hold_us : ep->hold_us;
+}
+
+static bool endpoint_accepts(const struct endpoint *ep, uint32_t msgid) {
+	if (ep->allow_count && !msgid_in(ep->allow, ep->allow_count, msgid))
+		return false;
+	return !msgid_in(ep->deny, ep->deny_count, msgid);
+}
+
+// Token bucket holding up to one second worth of bytes. The tokens are kept in
+// 1/1000 byte so that no fraction is lost when calls come every millisecond.
+static bool endpoint_rate_ok(struct endpoint *ep, size_t len) {
+	if (ep->rate == 0)
+		return true;
+
+	uint64_t now = get_current_time_ms();
+	uint64_t elapsed = now - ep->refill_ms;
+	ep->tokens = elapsed >= 1000 ? ep->rate * 1000 : ep->tokens + (long)elapsed * ep->rate;
+	if (ep->tokens > ep->rate * 1000)
+		ep->tokens = ep->rate * 1000;
+	ep->refill_ms = now;
+
+	if (ep->tokens < (long)len * 1000) {
+		ep->limited++;
+		return false;
+	}
+	ep->tokens -= len * 1000;
+	return true;
+}
+
+static void hold_hist_add(unsigned long *hist, uint64_t us) {
+	int bucket = us < 128 ? 0 : 63 - __builtin_clzll(us) - 6;
+	hist[bucket < HOLD_HIST_BUCKETS ? bucket : HOLD_HIST_BUCKETS - 1]++;
+}
+
+static void hold_hist_print(const unsigned long *hist) {
+	for (int i = 0; i < HOLD_HIST_BUCKETS; i++) {
+		if (!hist[i])
+			continue;
+		unsigned long us = 128UL << i;
+		if (i == HOLD_HIST_BUCKETS - 1)
+			printf(" >=%luus:%lu", us / 2, hist[i]);
+		else
+			printf(" <%luus:%lu", us, hist[i]);
+	}
+	printf("\n");
+}
+
+static void class_arm(struct class_queue *q, uint64_t now) {
+	if (!q->hold_ev)
+		return;
+	uint64_t deadline = q->queued_us[0] + class_hold(q->ep, q - q->ep->queues);
+	uint64_t wait = deadline > now ? deadline - now : 0;
+	struct timeval tv = {.tv_sec = wait / 1000000, .tv_usec = wait % 1000000};
+	evtimer_add(q->hold_ev, &tv);
+}
+
+/// @brief Queues the frames as a datagram of the endpoint, in an envelope if it packs
+static void endpoint_send(struct endpoint *ep, struct frame_ref *const *frames, int count) {
+	size_t total = 0, len;
+	for (int i = 0; i < count; i++)
+		total += frames[i]->len;
+	if (!ep->fec && !ep->pack) {
+		egress_send_frames(&ep->addr, frames, count);
+		return;
+	}
+
+	if (!ep->fec)
+		len = egress_send_packed(&ep->addr, frames, count, &ep->pack_ns);
+	else {
+		// built in the group of the encoder, which keeps it for the parity
+		uint8_t *buf = fec_next(ep->fec);
+		if (ENVELOPE_HEADER_LEN + total > FEC_MAX_LEN)
+			return;
+		if (ep->pack) {
+			uint64_t start = get_current_time_ns();
+			len = envelope_pack(frames, count, buf);
+			ep->pack_ns += get_current_time_ns() - start;
+		} else {
+			for (int i = 0, pos = 0; i < count; pos += frames[i++]->len)
+				frame_copy(frames[i], buf + pos);
+			len = total;
+		}
+		fec_send(ep->fec, len);
+		egress_hold(frames, count);
+	}
+	if (!ep->pack || len == 0)
+		return;
+	ep->packed++;
+	ep->packed_in += total;
+	ep->packed_out += len;
+}
+
+/// @brief Sends one datagram, draining the classes in priority order within their budgets
+static void endpoint_flush(struct endpoint *ep) {
+	if (ep->queued == 0)
+		return;
+
+	struct frame_ref *out[ENDPOINT_MAX_FRAMES * CLASS_COUNT];
+	int n = 0;
+	size_t total = 0;
+	uint64_t now = get_current_time_us();
+
+	for (int c = 0; c < CLASS_COUNT; c++) {
+		struct class_queue *q = &ep->queues[c];
+		size_t budget = frame_classes[c].budget, used = 0;
+		int k = 0;
+		// the first frame of a class always fits its budget, so it can't stall
+		while (k < q->count && total + q->frames[k]->len <= ENDPOINT_MAX_BYTES &&
+			   (budget == 0 || used == 0 || used + q->frames[k]->len <= budget)) {
+			used += q->frames[k]->len;
+			total += q->frames[k]->len;
+			out[n++] = q->frames[k++];
+		}
+		if (k == 0)
+			continue;
+
+		hold_hist_add(q->hold_hist, now - q->queued_us[0]);
+
+		q->count -= k;
+		q->bytes -= used;
+		ep->queued -= k;
+		memmove(q->frames, q->frames + k, q->count * sizeof(q->frames[0]));
+		memmove(q->queued_us, q->queued_us + k, q->count * sizeof(q->queued_us[0]));
+		if (q->count == 0) {
+			if (q->hold_ev)
+				event_del(q->hold_ev);
+		} else
+			class_arm(q, now);
+	}
+
+	endpoint_send(ep, out, n);
+	if (verbose)
+		printf("%s: %d Pckts / %zu bytes sent, %d left\n", ep->name, n, total, ep->queued);
+
+	for (int i = 0; i < n; i++)
+		frame_release(out[i]);
+}
+
+/// @brief Queues a frame on an aggregating endpoint, returns true if that flushed the queue
+static bool endpoint_push(struct endpoint *ep, struct frame_ref *f) {
+	if (!endpoint_accepts(ep, f->msgid)) {
+		ep->filtered++;
+		return false;
+	}
+
+	struct class_queue *q = &ep->queues[f->cls];
+	if (q->count == ENDPOINT_MAX_FRAMES || q->bytes + f->len > ENDPOINT_MAX_BYTES)
+		endpoint_flush(ep);
+	// a class held back by its budget can still be full
+	if (q->count == ENDPOINT_MAX_FRAMES || q->bytes + f->len > ENDPOINT_MAX_BYTES) {
+		q->dropped++;
+		return false;
+	}
+	// only a frame that is queued takes tokens
+	if (!endpoint_rate_ok(ep, f->len))
+		return false;
+
+	uint64_t now = get_current_time_us();
+	f->refs++;
+	q->frames[q->count] = f;
+	q->queued_us[q->count++] = now;
+	q->bytes += f->len;
+	ep->queued++;
+	ep->frames++;
+	ep->bytes += f->len;
+	if (q->count == 1)
+		class_arm(q, now);
+
+	long agg = class_aggregate(ep, f->cls);
+	// We will send whole packets only if packets more than treshold
+	if (((agg >= 1 && agg < 50) && q->count >= agg) ||
+		// if buffer more than treshold MAVLINK_MSG_ID_ATTITUDE will always cause the buffer flushed
+		((agg > 50 && agg < 2000) && q->bytes >= (size_t)agg) ||
+		((ep->queued >= 3) && f->msgid == MAVLINK_MSG_ID_ATTITUDE)) {
+		endpoint_flush(ep);
+		return true;
+	}
+	return false;
+}
+
+static void endpoint_send_error(const struct sockaddr_in *dst) {
+	for (int i = 0; i < endpoint_count; i++)
+		if (endpoints[i].addr.sin_addr.s_addr == dst->sin_addr.s_addr &&
+			endpoints[i].addr.sin_port == dst->sin_port)
+			endpoints[i].errors++;
+}
+
+static void flush_extras();
+
+static void class_hold_cb(evutil_socket_t fd, short event, void *arg) {
+	(void)fd;
+	(void)event;
+	struct class_queue *q = arg;
+	q->ep->deadline_flushes++;
+	endpoint_flush(q->ep);
+	flush_extras();
+}
+
+static void endpoint_print_pack(const struct endpoint *ep) {
+	if (!ep->pack)
+		return;
+	printf("  packed %lu datagrams, %lu bytes into %lu (%.1f%%), %.2fus per datagram\n", ep->packed,
+		ep->packed_in, ep->packed_out,
+		ep->packed_in ? 100.0 * ep->packed_out / ep->packed_in : 0.0,
+		ep->packed ? ep->pack_ns / 1000.0 / ep->packed : 0.0);
+}
+
+static void endpoint_print_fec(const struct endpoint *ep) {
+	const struct fec_encoder *enc = ep->fec;
+	if (!enc)
+		return;
+	printf("  fec %u/%u: %lu groups (%lu sent before they were full), %lu data and %lu parity "
+		   "datagrams, %lu parity bytes, %.2fus per data datagram\n",
+		enc->k, enc->n, enc->groups, enc->early, enc->data, enc->parity, enc->parity_bytes,
+		enc->data ? enc->ns / 1000.0 / enc->data : 0.0);
+}
+
+static void endpoint_print_hold(const struct endpoint *ep) {
+	if (ep->aggregate == 0)
+		return;
+	printf("Endpoint %s hold times (%lu deadline flushes)\n", ep->name, ep->deadline_flushes);
+	for (int c = 0; c < CLASS_COUNT; c++) {
+		const struct class_queue *q = &ep->queues[c];
+		printf("  %-8s %lu dropped:", frame_classes[c].name, q->dropped);
+		hold_hist_print(q->hold_hist);
+	}
+}
+
+/* Hot path latency.
+ *
+ * Every frame parsed from the serial port is stamped when the read callback
+ * that completed it starts, when the scanner hands it to process_mavlink and
+ * when it reaches the endpoint queues. The send time is taken once per
+ * sendmmsg() batch. The deltas go into log-linear histograms of fixed size,
+ * one per stage and priority class, like HdrHistogram with 32 sub-buckets:
+ * values are kept within 3% up to 34s. Building with MAVFWD_LATENCY=0 (make
+ * LATENCY=0) removes the stamps and the histograms.
+ */
+#if MAVFWD_LATENCY
+#define LAT_SUB_BITS 5
+#define LAT_BUCKETS 1024 // ns values up to 2^35
+
+enum { STAGE_READ_FRAME, STAGE_FRAME_QUEUE, STAGE_QUEUE_SEND, STAGE_TOTAL, STAGE_COUNT };
+
+static const char *const stage_names[STAGE_COUNT] = {
+	"read-frame", "frame-queue", "queue-send", "total"};
+
+struct lat_hist {
+	uint32_t counts[LAT_BUCKETS];
+	uint64_t total;
+	uint64_t max;
+};
+
+static struct lat_hist latency[CLASS_COUNT][STAGE_COUNT];
+
+static uint64_t latency_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned lat_index(uint64_t ns) {
+	if (ns < 2 << LAT_SUB_BITS)
+		return ns;
+	unsigned msb = 63 - __builtin_clzll(ns);
+	unsigned i = ((msb - LAT_SUB_BITS) << LAT_SUB_BITS) + (ns >> (msb - LAT_SUB_BITS));
+	return i < LAT_BUCKETS ? i : LAT_BUCKETS - 1;
+}
+
+// Lowest value of a bucket
+static uint64_t lat_value(unsigned i) {
+	if (i < 2 << LAT_SUB_BITS)
+		return i;
+	unsigned k = i >> LAT_SUB_BITS;
+	return (uint64_t)(i - ((k - 1) << LAT_SUB_BITS)) << (k - 1);
+}
+
+static void lat_record(struct lat_hist *h, uint64_t ns) {
+	h->counts[lat_index(ns)]++;
+	h->total++;
+	if (ns > h->max)
+		h->max = ns;
+}
+
+static uint64_t lat_percentile(const struct lat_hist *h, double p) {
+	uint64_t want = h->total * p, seen = 0;
+	for (unsigned i = 0; i < LAT_BUCKETS; i++) {
+		seen += h->counts[i];
+		if (seen > want)
+			return lat_value(i) < h->max ? lat_value(i) : h->max;
+	}
+	return h->max;
+}
+
+/// @brief Stamps a frame the scanner just completed, read_ns is the read callback start
+static void latency_frame(struct frame_ref *f, uint64_t read_ns) {
+	f->read_ns = read_ns;
+	f->frame_ns = latency_now();
+}
+
+static void latency_queue(struct frame_ref *f) {
+	if (f->read_ns)
+		f->queue_ns = latency_now();
+}
+
+static void latency_sent(struct frame_ref *const *frames, int count) {
+	uint64_t now = 0;
+	for (int i = 0; i < count; i++) {
+		const struct frame_ref *f = frames[i];
+		if (!f->read_ns)
+			continue;
+		if (!now)
+			now = latency_now();
+		struct lat_hist *h = latency[f->cls];
+		lat_record(&h[STAGE_READ_FRAME], f->frame_ns - f->read_ns);
+		lat_record(&h[STAGE_FRAME_QUEUE], f->queue_ns - f->frame_ns);
+		lat_record(&h[STAGE_QUEUE_SEND], now - f->queue_ns);
+		lat_record(&h[STAGE_TOTAL], now - f->read_ns);
+	}
+}
+
+static void latency_print() {
+	for (int c = 0; c < CLASS_COUNT; c++) {
+		for (int s = 0; s < STAGE_COUNT; s++) {
+			const struct lat_hist *h = &latency[c][s];
+			if (!h->total)
+				continue;
+			printf("Latency %-8s %-11s p50 %.1fus p99 %.1fus p99.9 %.1fus max %.1fus (%" PRIu64
+				   " frames)\n",
+				frame_classes[c].name, stage_names[s], lat_percentile(h, 0.5) / 1e3,
+				lat_percentile(h, 0.99) / 1e3, lat_percentile(h, 0.999) / 1e3, h->max / 1e3,
+				h->total);
+		}
+	}
+}
+
+// "latency":{CLASS:{STAGE:{...}}}, in nanoseconds
+static void latency_json(struct evbuffer *out) {
+	evbuffer_add_printf(out, "\"latency\":{");
+	for (int c = 0; c < CLASS_COUNT; c++) {
+		evbuffer_add_printf(out, "%s\"%s\":{", c ? "," : "", frame_classes[c].name);
+		for (int s = 0; s < STAGE_COUNT; s++) {
+			const struct lat_hist *h = &latency[c][s];
+			evbuffer_add_printf(out,
+				"%s\"%s\":{\"count\":%" PRIu64 ",\"p50\":%" PRIu64 ",\"p99\":%" PRIu64
+				",\"p999\":%" PRIu64 ",\"max\":%" PRIu64 "}",
+				s ? "," : "", stage_names[s], h->total, lat_percentile(h, 0.5),
+				lat_percentile(h, 0.99), lat_percentile(h, 0.999), h->max);
+		}
+		evbuffer_add_printf(out, "}");
+	}
+	evbuffer_add_printf(out, "},");
+}
+#else
+static uint64_t latency_now() { return 0; }
+static void latency_frame(struct frame_ref *f, uint64_t read_ns) { (void)f, (void)read_ns; }
+static void latency_queue(struct frame_ref *f) { (void)f; }
+static void latency_sent(struct frame_ref *const *frames, int count) { (void)frames, (void)count; }
+static void latency_print() {}
+static void latency_json(struct evbuffer *out) { (void)out; }
+#endif
+
+/// @brief Hands a frame to every aggregating endpoint, returns true if any of them flushed
+static bool endpoints_fanout(struct frame_ref *f) {
+	bool flushed = false;
+	signing_prepare(f);
+	f->cls = msgid_class(f->msgid);
+	latency_queue(f);
+	for (int i = 0; i < endpoint_count; i++)
+		if (endpoints[i].aggregate > 0)
+			flushed |= endpoint_push(&endpoints[i], f);
+	return flushed;
+}
+
+/// @brief Sends a frame right away, as its own datagram, to every endpoint that accepts it
+static void endpoints_send_now(struct frame_ref *f) {
+	signing_prepare(f);
+	for (int i = 0; i < endpoint_count; i++) {
+		struct endpoint *ep = &endpoints[i];
+		if (!endpoint_accepts(ep, f->msgid)) {
+			ep->filtered++;
+			continue;
+		}
+		if (!endpoint_rate_ok(ep, f->len))
+			continue;
+		endpoint_send(ep, &f, 1);
+		ep->frames++;
+		ep->bytes += f->len;
+	}
+}
+
+/// @brief Forwards a piece of the raw serial stream to the raw endpoints
+static void endpoints_send_stream(const struct evbuffer_iovec *vec, int n, size_t skip) {
+	for (int e = 0; e < endpoint_count; e++) {
+		struct endpoint *ep = &endpoints[e];
+		if (ep->aggregate != 0)
+			continue;
+		size_t s = skip;
+		for (int i = 0; i < n; i++) {
+			if (s >= vec[i].iov_len) {
+				s -= vec[i].iov_len;
+				continue;
+			}
+			size_t len = vec[i].iov_len - s;
+			if (endpoint_rate_ok(ep, len)) {
+				egress_send_stream(&ep->addr, (uint8_t *)vec[i].iov_base + s, len);
+				ep->bytes += len;
+			}
+			s = 0;
+		}
+	}
+}
+
+static void send_statustext(const char *text, size_t text_len, uint16_t id, uint8_t chunk_seq) {
+	char chunk[MAVLINK_MSG_STATUSTEXT_FIELD_TEXT_LEN] = {0};
+	memcpy(chunk, text, text_len < sizeof(chunk) ? text_len : sizeof(chunk));
+
+	mavlink_message_t message;
+	mavlink_msg_statustext_pack_chan(system_id,
+		MAV_COMP_ID_SYSTEM_CONTROL, MAVLINK_COMM_1, &message, 4, chunk, id, chunk_seq);
+
+	uint8_t buffer[MAVLINK_MAX_PACKET_LEN];
+	int len = mavlink_msg_to_send_buffer(buffer, &message);
+	struct frame_ref *f = frame_from_buffer(buffer, len, MAVLINK_MSG_ID_STATUSTEXT);
+	if (f) {
+		endpoints_send_now(f);
+		frame_release(f);
+	}
+}
+
+/// @brief Sends each line of text as a STATUSTEXT, long lines are split into chunks with an id
+static void send_text_to_groundstation(const char *text, size_t len) {
+	static uint16_t text_id = 0;
+	const size_t chunk = MAVLINK_MSG_STATUSTEXT_FIELD_TEXT_LEN;
+
+	while (len > 0) {
+		const char *eol = memchr(text, '\n', len);
+		size_t line = eol ? (size_t)(eol - text) : len;
+
+		if (line > 0 && line <= chunk)
+			send_statustext(text, line, 0, 0);
+		else if (line > chunk) {
+			if (++text_id == 0)
+				text_id = 1;
+			// a line that fills its last chunk is ended by an empty one
+			for (size_t off = 0, seq = 0; off <= line; off += chunk, seq++)
+				send_statustext(text + off, line - off, text_id, seq);
+		}
+
+		line += eol ? 1 : 0;
+		text += line;
+		len -= line;
+	}
+}
+
+static void send_msg_to_groundstation(const char *msg_buf) {
+	send_text_to_groundstation(msg_buf, strlen(msg_buf));
+}
+
+/* Command executor.
+ *
+ * RC channel actions used to go through system(), which forks the whole of
+ * mavfwd plus a shell on the event loop thread. A helper process is forked once
+ * at start, while mavfwd is still small, and the loop hands it requests through
+ * a non-blocking pipe. The helper posix_spawn()s each command and reports its
+ * exit status and timings back through a second pipe.
+ */
+#define CMD_MAX_ARGS 4
+#define CMD_ARG_LEN 64
+#define CMD_MAX_RUNNING 32
+
+struct cmd_request {
+	uint32_t id;
+	uint64_t queued_us;
+	char argv[CMD_MAX_ARGS][CMD_ARG_LEN];
+};
+
+struct cmd_result {
+	uint32_t id;
+	int status; // exit code, 128 + signal, or -errno if it could not be started
+	uint64_t queued_us;
+	uint64_t spawned_us;
+	uint64_t exited_us;
+	char cmd[CMD_ARG_LEN];
+};
+
+static struct {
+	pid_t pid;
+	int req_fd; // write end, non-blocking
+	int res_fd; // read end
+	struct event *res_ev;
+	uint32_t next_id;
+
+	unsigned long submitted;
+	unsigned long completed;
+	unsigned long failed;
+	unsigned long dropped;
+	uint64_t max_spawn_us;
+} executor = {.pid = -1, .req_fd = -1, .res_fd = -1};
+
+static void cmd_helper_spawn(const struct cmd_request *req, posix_spawnattr_t *attr,
+	struct cmd_result *res, pid_t *pid) {
+	// The shell prefix is only used for scripts the kernel cannot execute
+	char *argv[CMD_MAX_ARGS + 3] = {"/bin/sh", "-c", "\"$0\" \"$@\""};
+	int argc = 3;
+	for (int i = 0; i < CMD_MAX_ARGS && req->argv[i][0]; i++)
+		argv[argc++] = (char *)req->argv[i];
+
+	*res = (struct cmd_result){.id = req->id, .queued_us = req->queued_us};
+	snprintf(res->cmd, sizeof(res->cmd), "%s", req->argv[0]);
+
+	int err = posix_spawnp(pid, argv[3], NULL, attr, argv + 3, environ);
+	// A script without #! line, run it the way system() did
+	if (err == ENOEXEC)
+		err = posix_spawn(pid, argv[0], NULL, attr, argv, environ);
+	res->spawned_us = get_current_time_us();
+	if (err) {
+		*pid = -1;
+		res->status = -err;
+		res->exited_us = res->spawned_us;
+	}
+}
+
+static void cmd_helper(int req_fd, int res_fd) {
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	int sig_fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+
+	// Ctrl-C and `killall -usr1 mavfwd` are meant for the forwarder, the helper
+	// leaves when the request pipe is closed
+	signal(SIGINT, SIG_IGN);
+	signal(SIGUSR1, SIG_IGN);
+	signal(SIGPIPE, SIG_IGN);
+
+	posix_spawnattr_t attr;
+	sigset_t def, none;
+	sigemptyset(&def);
+	sigaddset(&def, SIGINT);
+	sigaddset(&def, SIGUSR1);
+	sigaddset(&def, SIGPIPE);
+	sigemptyset(&none);
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setsigdefault(&attr, &def);
+	posix_spawnattr_setsigmask(&attr, &none);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+	struct {
+		pid_t pid;
+		struct cmd_result res;
+	} running[CMD_MAX_RUNNING];
+	int nrunning = 0;
+
+	struct pollfd fds[2] = {{.fd = req_fd, .events = POLLIN}, {.fd = sig_fd, .events = POLLIN}};
+	for (;;) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (fds[0].revents) {
+			struct cmd_request req;
+			if (read(req_fd, &req, sizeof(req)) != sizeof(req))
+				break; // mavfwd is gone
+			req.argv[CMD_MAX_ARGS - 1][CMD_ARG_LEN - 1] = '\0';
+
+			struct cmd_result res;
+			pid_t pid = -1;
+			if (nrunning == CMD_MAX_RUNNING)
+				res = (struct cmd_result){.id = req.id, .status = -EAGAIN};
+			else
+				cmd_helper_spawn(&req, &attr, &res, &pid);
+
+			if (pid > 0) {
+				running[nrunning].pid = pid;
+				running[nrunning++].res = res;
+			} else
+				write(res_fd, &res, sizeof(res));
+		}
+
+		if (fds[1].revents) {
+			struct signalfd_siginfo si;
+			while (read(sig_fd, &si, sizeof(si)) == sizeof(si))
+				;
+			int status;
+			pid_t pid;
+			while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+				for (int i = 0; i < nrunning; i++) {
+					if (running[i].pid != pid)
+						continue;
+					struct cmd_result *res = &running[i].res;
+					res->exited_us = get_current_time_us();
+					res->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+					write(res_fd, res, sizeof(*res));
+					running[i] = running[--nrunning];
+					break;
+				}
+			}
+		}
+	}
+	_exit(0);
+}
+
+static void cmd_result_cb(evutil_socket_t fd, short event, void *arg) {
+	(void)event;
+	(void)arg;
+	struct cmd_result res;
+	ssize_t n;
+
+	while ((n = read(fd, &res, sizeof(res))) == sizeof(res)) {
+		uint64_t spawn_us = res.spawned_us - res.queued_us;
+		if (spawn_us > executor.max_spawn_us)
+			executor.max_spawn_us = spawn_us;
+		if (res.status < 0) {
+			executor.failed++;
+			printf("Command %u %s could not be started: %s\n", res.id, res.cmd,
+				strerror(-res.status));
+			continue;
+		}
+		executor.completed++;
+		if (verbose || res.status)
+			printf("Command %u %s exited with %d, started after %.1f ms, ran %.1f ms\n", res.id,
+				res.cmd, res.status, spawn_us / 1000.0, (res.exited_us - res.spawned_us) / 1000.0);
+	}
+	if (n == 0) {
+		printf("Command executor exited\n");
+		event_del(executor.res_ev);
+		close(executor.req_fd);
+		executor.req_fd = -1;
+	}
+}
+
+/// @brief Forks the helper, before the event loop and the serial port exist
+static bool cmd_executor_start() {
+	int req[2], res[2];
+	if (pipe2(req, O_CLOEXEC) || pipe2(res, O_CLOEXEC)) {
+		perror("pipe2()");
+		return false;
+	}
+
+	fflush(stdout);
+	executor.pid = fork();
+	if (executor.pid < 0) {
+		perror("fork()");
+		return false;
+	}
+	if (executor.pid == 0) {
+		close(req[1]);
+		close(res[0]);
+		cmd_helper(req[0], res[1]);
+	}
+
+	close(req[0]);
+	close(res[1]);
+	executor.req_fd = req[1];
+	executor.res_fd = res[0];
+	evutil_make_socket_nonblocking(executor.req_fd);
+	evutil_make_socket_nonblocking(executor.res_fd);
+	return true;
+}
+
+static void cmd_executor_stop() {
+	if (executor.res_ev)
+		event_free(executor.res_ev);
+	if (executor.req_fd >= 0)
+		close(executor.req_fd);
+	if (executor.pid > 0) {
+		waitpid(executor.pid, NULL, 0);
+		printf("Commands: %lu submitted, %lu completed, %lu failed, %lu dropped, "
+			   "max start latency %.1f ms\n",
+			executor.submitted, executor.completed, executor.failed, executor.dropped,
+			executor.max_spawn_us / 1000.0);
+	}
+	if (executor.res_fd >= 0)
+		close(executor.res_fd);
+}
+
+/// @brief Queues a command for the helper, never blocks, argv is NULL terminated
+static bool cmd_submit(const char *const argv[]) {
+	if (executor.req_fd < 0) {
+		printf("No command executor, %s not started\n", argv[0]);
+		return false;
+	}
+
+	struct cmd_request req = {.id = executor.next_id++, .queued_us = get_current_time_us()};
+	for (int i = 0; i < CMD_MAX_ARGS && argv[i]; i++)
+		snprintf(req.argv[i], CMD_ARG_LEN, "%s", argv[i]);
+
+	// Requests are smaller than PIPE_BUF, the write is all or nothing
+	if (write(executor.req_fd, &req, sizeof(req)) != sizeof(req)) {
+		executor.dropped++;
+		printf("Command queue full, %s dropped\n", argv[0]);
+		return false;
+	}
+	executor.submitted++;
+	return true;
+}
+
+static void dump_mavlink_packet(unsigned char *data, const char *direction) {
+	uint8_t seq;
+	uint8_t sys_id;
+	uint8_t comp_id;
+	uint32_t msg_id;
+
+	if (data[0] == 0xFE) { // mavlink 1
+		seq = data[2];
+		sys_id = data[3];
+		comp_id = data[4];
+		msg_id = data[5];
+	} else { // mavlink 2
+		seq = data[4];
+		sys_id = data[5];
+		comp_id = data[6];
+		msg_id = data[7] | (data[8] << 8) | ((uint32_t)data[9] << 16);
+	}
+
+	if (verbose)
+		printf("%s %#02x sender %d/%d\t%d\t%d\n", direction, data[0], sys_id, comp_id, seq, msg_id);
+
+	uint16_t val;
+	if ((msg_id == RC_CHANNELS || msg_id == RC_CHANNELS_RAW) && ch_count > 0) {
+		uint8_t offset = 18; // 15 = 1ch;
+		for (uint8_t i = 0; i < ch_count; i++) {
+			val = data[offset] | (data[offset + 1] << 8);
+			if (ch[i] != val) {
+				ch[i] = val;
+				char chan[12], value[12];
+				sprintf(chan, "%d", i + 5);
+				sprintf(value, "%d", val);
+				cmd_submit((const char *[]){"channels.sh", chan, value, NULL});
+				if (verbose)
+					printf("called channels.sh %d %d\n", i + 5, val);
+			}
+			offset = offset + 2;
+		} // for
+	}	  // msg_id
+}
+
+/* https://discuss.ardupilot.org/uploads/short-url/vS0JJd3BQfN9uF4DkY7bAeb6Svd.pdf
+ * 0. Message header, always 0xFE
+ * 1. Message length
+ * 2. Sequence number -- rolls around from 255 to 0 (0x4e, previous was 0x4d)
+ * 3. System ID - what system is sending this message
+ * 4. Component ID- what component of the system is sending the message
+ * 5. Message ID (e.g. 0 = heartbeat and many more! Don’t be shy, you can add too..)
+ */
+static bool get_mavlink_packet(unsigned char *in_buffer, int buf_len, int *packet_len) {
+	if (buf_len < 6 /* header */) {
+		return false;
+	}
+	assert(in_buffer[0] == 0xFE || in_buffer[0] == 0xFD); // mavlink 1 or 2
+
+	uint8_t msg_len = in_buffer[1];
+	if (in_buffer[0] == 0xFE)
+		*packet_len = 6 /* header */ + msg_len + 2 /* crc */; // mavlink 1
+	else
+		*packet_len = 10 /* header */ + msg_len + 2 /* crc */; // mavlink 2
+	if (buf_len < *packet_len)
+		return false;
+
+	dump_mavlink_packet(in_buffer, ">>");
+
+	return true;
+}
+
+// Returns num bytes before first occurrence of 0xFE or full data length
+static size_t until_first_fe(unsigned char *data, size_t len) {
+	for (size_t i = 1; i < len; i++) {
+		if (data[i] == 0xFE || data[i] == 0xFD) {
+			return i;
+		}
+	}
+	return len;
+}
+
+static char MavLinkMsgFile[128] = "mavlink.msg";
+static char WfbLogFile[128] = "wfb.log";
+
+/* mavlink.msg spool.
+ *
+ * Text written to mavlink.msg in the --folder, or to mavlink.msg.N when several
+ * messages are queued, is sent to the ground as STATUSTEXT, one per line, and
+ * the file is deleted. The folder is watched with inotify and a file is read
+ * once it is closed after writing or moved in. Without inotify mavlink.msg is
+ * checked at every aggregation flush.
+ */
+#define MSG_SPOOL_MAX 4096
+
+static struct {
+	int fd;
+	struct event *ev;
+	char dir[128];
+	char base[128]; // file name part of MavLinkMsgFile
+
+	unsigned long files;
+} msg_spool = {.fd = -1};
+
+// mavlink.msg or mavlink.msg.N
+static bool msg_spool_match(const char *name) {
+	size_t len = strlen(msg_spool.base);
+	if (strncmp(name, msg_spool.base, len))
+		return false;
+	if (name[len] == '\0')
+		return true;
+	if (name[len] != '.' || name[len + 1] == '\0')
+		return false;
+	for (const char *p = name + len + 1; *p; p++)
+		if (!isdigit((unsigned char)*p))
+			return false;
+	return true;
+}
+
+static void msg_spool_send(const char *name) {
+	char path[256], claim[256];
+	snprintf(path, sizeof(path), "%s/%s", msg_spool.dir, name);
+	snprintf(claim, sizeof(claim), "%s/.%s.sending", msg_spool.dir, name);
+
+	// Take the file away first, a writer that comes later starts a new one
+	if (rename(path, claim) != 0) {
+		if (errno != ENOENT)
+			printf("Cannot take %s: %s\n", path, strerror(errno));
+		return;
+	}
+
+	char text[MSG_SPOOL_MAX];
+	size_t len = 0;
+	FILE *file = fopen(claim, "rb");
+	if (file) {
+		len = fread(text, 1, sizeof(text), file);
+		if (fgetc(file) != EOF)
+			printf("%s is longer than %d bytes, the rest is dropped\n", path, MSG_SPOOL_MAX);
+		fclose(file);
+	}
+	if (remove(claim) != 0)
+		printf("Error deleting file %s\n", claim);
+
+	if (len == 0) {
+		printf("Mavlink empty file ?!\n");
+		return;
+	}
+	if (verbose)
+		printf("Mavlink msg from file %s:%.*s\n", name, (int)len, text);
+	msg_spool.files++;
+	send_text_to_groundstation(text, len);
+}
+
+static int msg_spool_filter(const struct dirent *d) {
+	return msg_spool_match(d->d_name);
+}
+
+// Sends what is already queued, in mavlink.msg, mavlink.msg.1, mavlink.msg.2... order
+static void msg_spool_scan() {
+	struct dirent **list;
+	int n = scandir(msg_spool.dir, &list, msg_spool_filter, versionsort);
+	for (int i = 0; i < n; i++) {
+		msg_spool_send(list[i]->d_name);
+		free(list[i]);
+	}
+	if (n >= 0)
+		free(list);
+}
+
+static void msg_spool_cb(evutil_socket_t fd, short event, void *arg) {
+	(void)event;
+	(void)arg;
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		for (char *p = buf; p < buf + len;) {
+			const struct inotify_event *ev = (const struct inotify_event *)p;
+			if (ev->mask & IN_Q_OVERFLOW)
+				msg_spool_scan();
+			else if (ev->len && msg_spool_match(ev->name))
+				msg_spool_send(ev->name);
+			p += sizeof(*ev) + ev->len;
+		}
+	}
+}
+
+static void msg_spool_init(struct event_base *base) {
+	const char *slash = strrchr(MavLinkMsgFile, '/');
+	if (slash) {
+		snprintf(msg_spool.dir, sizeof(msg_spool.dir), "%.*s",
+			(int)(slash - MavLinkMsgFile), MavLinkMsgFile);
+		if (msg_spool.dir[0] == '\0')
+			strcpy(msg_spool.dir, "/");
+	} else
+		strcpy(msg_spool.dir, ".");
+	snprintf(msg_spool.base, sizeof(msg_spool.base), "%s", slash ? slash + 1 : MavLinkMsgFile);
+
+	msg_spool.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (msg_spool.fd < 0 ||
+		inotify_add_watch(msg_spool.fd, msg_spool.dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		printf("Cannot watch %s (%s), checking %s on every flush\n", msg_spool.dir,
+			strerror(errno), MavLinkMsgFile);
+		if (msg_spool.fd >= 0)
+			close(msg_spool.fd);
+		msg_spool.fd = -1;
+		return;
+	}
+
+	msg_spool.ev = event_new(base, msg_spool.fd, EV_READ | EV_PERSIST, msg_spool_cb, NULL);
+	event_add(msg_spool.ev, NULL);
+	msg_spool_scan();
+}
+
+static void msg_spool_free() {
+	if (msg_spool.ev)
+		event_free(msg_spool.ev);
+	if (msg_spool.fd >= 0)
+		close(msg_spool.fd);
+}
+
+/* wfb.log tailer.
+ *
+ * wfb_tx output is appended to wfb.log by tee. The file is kept open and a
+ * one second timer parses only what was written since the last tick, adding up
+ * the "UDP rxq overflow: N packets dropped" lines, then reports the drops per
+ * second. A file that shrank was truncated and is read again from the start, a
+ * new file under the same name (rotation) is reopened. The file is only read:
+ * truncating it under a tee without -a would leave a hole of NULs where tee
+ * writes next, so its size is up to whoever starts tee (tee -a, logrotate).
+ */
+#define WFB_TAIL_LINE 200
+
+static struct {
+	int fd;
+	ino_t ino;
+	off_t offset;
+	bool opened; // history before the first open is not reported
+	char line[WFB_TAIL_LINE];
+	size_t line_len;
+	bool line_long; // skipping the rest of a line longer than line
+
+	unsigned long dropped; // since the last report
+	unsigned long total;
+	uint64_t report_ms;
+	struct event *timer;
+} wfb_tail = {.fd = -1};
+
+static void wfb_tail_line(const char *s, size_t len) {
+	/*
+	UDP rxq overflow: 2 packets dropped
+	UDP rxq overflow: 45 packets dropped
+	*/
+	static const char marker[] = "packets dropped";
+	if (!memmem(s, len, marker, sizeof(marker) - 1))
+		return;
+
+	// the count is the first word made of digits
+	for (size_t i = 0; i < len; i++) {
+		if (!isdigit((unsigned char)s[i]) || (i > 0 && s[i - 1] != ' '))
+			continue;
+		unsigned long n = 0;
+		while (i < len && isdigit((unsigned char)s[i]))
+			n = n * 10 + (s[i++] - '0');
+		wfb_tail.dropped += n;
+		return;
+	}
+}
+
+static void wfb_tail_parse(const char *data, size_t len) {
+	while (len > 0) {
+		const char *eol = memchr(data, '\n', len);
+		size_t n = eol ? (size_t)(eol - data) : len;
+
+		if (wfb_tail.line_len == 0 && !wfb_tail.line_long && eol) {
+			// whole line in the chunk, parse it where it is
+			wfb_tail_line(data, n);
+		} else {
+			size_t room = sizeof(wfb_tail.line) - wfb_tail.line_len;
+			if (n > room) {
+				n = room;
+				wfb_tail.line_long = true;
+			}
+			memcpy(wfb_tail.line + wfb_tail.line_len, data, n);
+			wfb_tail.line_len += n;
+			if (eol) {
+				wfb_tail_line(wfb_tail.line, wfb_tail.line_len);
+				wfb_tail.line_len = 0;
+				wfb_tail.line_long = false;
+			}
+			n = eol ? (size_t)(eol - data) : len;
+		}
+
+		n += eol ? 1 : 0;
+		data += n;
+		len -= n;
+	}
+}
+
+static void wfb_tail_read() {
+	struct stat st;
+	if (stat(WfbLogFile, &st) != 0) {
+		if (verbose && wfb_tail.fd < 0)
+			printf("No file %s\n", WfbLogFile);
+		return;
+	}
+
+	if (wfb_tail.fd < 0 || st.st_ino != wfb_tail.ino) {
+		if (wfb_tail.fd >= 0)
+			close(wfb_tail.fd);
+		wfb_tail.fd = open(WfbLogFile, O_RDONLY | O_CLOEXEC);
+		if (wfb_tail.fd < 0 || fstat(wfb_tail.fd, &st) != 0) {
+			printf("Cannot open %s: %s\n", WfbLogFile, strerror(errno));
+			return;
+		}
+		wfb_tail.ino = st.st_ino;
+		wfb_tail.offset = wfb_tail.opened ? 0 : st.st_size;
+		wfb_tail.line_len = 0;
+		wfb_tail.line_long = false;
+		if (verbose)
+			printf("Tailing %s from %lld\n", WfbLogFile, (long long)wfb_tail.offset);
+		wfb_tail.opened = true;
+	} else if (fstat(wfb_tail.fd, &st) == 0 && st.st_size < wfb_tail.offset) {
+		// truncated by someone else
+		wfb_tail.offset = 0;
+		wfb_tail.line_len = 0;
+		wfb_tail.line_long = false;
+	}
+
+	char buf[4096];
+	ssize_t n;
+	while ((n = pread(wfb_tail.fd, buf, sizeof(buf), wfb_tail.offset)) > 0) {
+		wfb_tail_parse(buf, n);
+		wfb_tail.offset += n;
+	}
+}
+
+/// @brief wfb_tx output should be redirected to wfb.log. Reports the dropped packets once a second
+static void SendWfbLogToGround(evutil_socket_t fd, short event, void *arg) {
+	(void)fd;
+	(void)event;
+	(void)arg;
+
+	wfb_tail_read();
+
+	uint64_t now = get_current_time_ms();
+	uint64_t elapsed = now - wfb_tail.report_ms;
+	wfb_tail.report_ms = now;
+	if (wfb_tail.dropped == 0 || elapsed == 0)
+		return;
+
+	char msg_buf[MAVLINK_MSG_STATUSTEXT_FIELD_TEXT_LEN + 1];
+	snprintf(msg_buf, sizeof(msg_buf), "%lu video pckts dropped, %lu/s", wfb_tail.dropped,
+		wfb_tail.dropped * 1000 / elapsed);
+	printf("%s\n", msg_buf);
+	send_msg_to_groundstation(msg_buf);
+
+	wfb_tail.total += wfb_tail.dropped;
+	wfb_tail.dropped = 0;
+}
+
+static void wfb_tail_init(struct event_base *base) {
+	wfb_tail.report_ms = get_current_time_ms();
+	wfb_tail_read();
+	wfb_tail.timer = event_new(base, -1, EV_PERSIST, SendWfbLogToGround, NULL);
+	evtimer_add(wfb_tail.timer, &(struct timeval){.tv_sec = 1});
+}
+
+static void wfb_tail_free() {
+	if (wfb_tail.timer)
+		event_free(wfb_tail.timer);
+	if (wfb_tail.fd >= 0)
+		close(wfb_tail.fd);
+	if (wfb_tail.total)
+		printf("%lu video packets dropped in total\n", wfb_tail.total);
+}
+
+// Only used without inotify, otherwise the spool is sent as soon as it is written
+static void SendInfoToGround() {
+	if (msg_spool.fd < 0)
+		msg_spool_send(msg_spool.base);
+}
+
+uint64_t get_current_time_ms_Old() {
+	time_t current_time = time(NULL);
+	return (uint64_t)(current_time * 1000);
+}
+
+static float last_board_temp;
+
+/// @brief
+/// @return -100 if no sigmastar found
+static int GetTempSigmaStar() {
+	// https://wx.comake.online/doc/doc/SigmaStarDocs-SSD220-SIGMASTAR-202305231834/platform/BSP/Ikayaki/frequency_en.html
+	FILE *file = fopen("/sys/devices/virtual/mstar/msys/TEMP_R", "r"); // Temperature 62
+	if (file == NULL) {
+		if (verbose)
+			printf("No temp data at %s\n", WfbLogFile);
+		return -100;
+	}
+
+	last_board_temp = -100;
+	char buff[200];
+	// Read lines from the file and parse for dropped packets
+	if (fgets(buff, sizeof(buff), file) != NULL) {
+		// Find "Temperature"
+		char *temperature_str = strstr(buff, "Temperature");
+		if (temperature_str != NULL)
+			// Extract temperature value
+			last_board_temp = atoi(temperature_str + 12);
+	}
+
+	fclose(file);
+
+	if (verbose && last_board_temp < -90)
+		printf("No temp data in file %s\n", WfbLogFile);
+
+	return last_board_temp;
+}
+
+static uint64_t LastTempSent;
+
+static int SendTempToGround(unsigned char *mavbuf) {
+	// Once a second
+	if (abs(get_current_time_ms() - LastTempSent) < 1000)
+		return 0;
+
+	LastTempSent = abs(get_current_time_ms());
+
+	// read the temperature only once per second
+	if (temp == 2)
+		last_board_temp = GetTempSigmaStar();
+
+	mavlink_message_t message;
+	mavlink_msg_raw_imu_pack_chan(system_id, MAV_COMP_ID_SYSTEM_CONTROL, MAVLINK_COMM_1, &message,
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, last_board_temp * 100);
+
+	return mavlink_msg_to_send_buffer(mavbuf, &message);
+}
+
+bool version_shown = false;
+static void ShowVersionOnce(mavlink_message_t *msg, uint8_t header) {
+	if (version_shown)
+		return;
+
+	version_shown = true;
+	/*
+	The major version can be determined from the packet start marker byte:
+	MAVLink 1: 0xFE
+	MAVLink 2: 0xFD
+	*/
+	if (header == 0xFE)
+		printf("Detected MAVLink ver: 1.0  (%d)\n", msg->magic);
+	if (header == 0xFD)
+		printf("Detected MAVLink version: 2.0  (%d)\n", msg->magic);
+
+	printf("System_id = %d \n", system_id);
+}
+
+bool fc_shown = false;
+
+void handle_heartbeat(const mavlink_message_t *message) {
+	if (fc_shown)
+		return;
+
+	fc_shown = true;
+	mavlink_heartbeat_t heartbeat;
+	mavlink_msg_heartbeat_decode(message, &heartbeat);
+
+	printf("Flight Controller Type :");
+
+	switch (heartbeat.autopilot) {
+	case MAV_AUTOPILOT_GENERIC:
+		printf("Generic/INAV");
+		break;
+
+	case MAV_AUTOPILOT_ARDUPILOTMEGA:
+		printf("ArduPilot");
+		break;
+
+	case MAV_AUTOPILOT_PX4:
+		printf("PX4");
+		break;
+
+	default:
+		printf("other");
+		break;
+	}
+
+	printf("\n");
+}
+
+void handle_statustext(const mavlink_message_t *message) {
+	mavlink_statustext_t statustext;
+	mavlink_msg_statustext_decode(message, &statustext);
+	printf("FC message:%s", statustext.text);
+}
+
+unsigned long long get_current_time_ms_simple() {
+	clock_t current_clock_ticks = clock();
+	return (unsigned long long)(current_clock_ticks * 1000 / CLOCKS_PER_SEC);
+}
+
+uint16_t channels[18];
+
+// how long a RC value should stay at one level to issue a command
+static uint64_t LastStart = 0;
+static unsigned long LastValue = 0;
+uint16_t NewValue;
+static uint64_t NewValueStart = 0;
+unsigned int ChannelCmds = 0;
+static uint64_t mavpckts_ttl = 0;
+
+void ProcessChannels() {
+	// ch_count , not zero based, 1 is first
+	uint16_t val = 0;
+	if (ch_count < 1 ||
+		// wait in the beginning for the values to settle
+		ch_count > 16 /* || (mavpckts_ttl<100*/)
+		return;
+
+	if (abs(get_current_time_ms() - LastStart) < wait_after_bash)
+		return;
+
+	val = channels[ch_count - 1];
+
+	if (abs(val - NewValue) > 32 && ChannelPersistPeriodmMS > 0) {
+		// We have a new value, let us wait for it to persist
+		NewValue = val;
+		NewValueStart = get_current_time_ms();
+		return;
+	} else if (abs(get_current_time_ms() - NewValueStart) < ChannelPersistPeriodmMS)
+		// New value should remain "stable" for a second before being approved
+		return;
+	else {
+	} // New value persisted for more THAN ChannelPersistPeriodmMS
+
+	// the change is too small
+	if (abs(val - LastValue) < 32)
+		return;
+
+	NewValue = val;
+	LastValue = val;
+
+	char chan[12], value[12];
+	sprintf(chan, "%d", ch_count);
+	sprintf(value, "%d", val);
+
+	printf("Starting(%d): /usr/bin/channels.sh %s %s\n", ChannelCmds, chan, value);
+	LastStart = get_current_time_ms();
+
+	// intentionally skip the first command, since when stating mavfwd it
+	// will always receive some channel value and execute the script
+	if (ChannelCmds > 0) {
+		cmd_submit((const char *[]){"/usr/bin/channels.sh", chan, value, NULL});
+	}
+
+	ChannelCmds++;
+}
+
+void showchannels(int count) {
+	if (verbose) {
+		printf("Channels :");
+		for (int i = 0; i < count; i++)
+			printf("| %02d", channels[i]);
+		printf("\n");
+	}
+}
+
+void handle_msg_id_rc_channels_raw(const mavlink_message_t *message) {
+	mavlink_rc_channels_raw_t rc_channels;
+	mavlink_msg_rc_channels_raw_decode(message, &rc_channels);
+	memcpy(&channels[0], &rc_channels.chan1_raw, 8 * sizeof(uint16_t));
+	showchannels(8);
+	ProcessChannels();
+}
+
+void handle_msg_id_rc_channels_override(const mavlink_message_t *message) {
+	mavlink_rc_channels_override_t rc_channels;
+	mavlink_msg_rc_channels_override_decode(message, &rc_channels);
+	memcpy(&channels[0], &rc_channels.chan1_raw, 18 * sizeof(uint16_t));
+	showchannels(18);
+	ProcessChannels();
+}
+
+void handle_msg_id_rc_channels(const mavlink_message_t *message) {
+	mavlink_rc_channels_t rc_channels;
+	mavlink_msg_rc_channels_decode(message, &rc_channels);
+	memcpy(&channels[0], &rc_channels.chan1_raw, 18 * sizeof(uint16_t));
+	showchannels(18);
+	ProcessChannels();
+}
+
+/* Frame scanner for the serial input.
+ *
+ * Works directly on the evbuffer segments returned by evbuffer_peek(), so the
+ * stream is never pulled up or fed one byte at a time through
+ * mavlink_parse_char(). Frame boundaries come from the STX/len header and the
+ * CRC is checked in place. A frame cut off by the end of the data stays at the
+ * head of the evbuffer, and the scanner remembers how far its CRC got, so the
+ * next read callback continues where this one stopped.
+ */
+#define SCAN_MAX_IOV 16
+#define SCAN_MAX_FRAMES 64
+
+// A complete frame inside the scanned evbuffer
+struct mav_frame {
+	size_t offset; // from the start of the evbuffer
+	uint16_t len;  // whole frame, STX to CRC (and signature)
+	uint32_t msgid;
+	uint8_t magic;
+	uint8_t seq;
+	uint8_t sysid;
+	uint8_t compid;
+	bool verified; // false if the msgid is unknown and the CRC could not be checked
+};
+
+struct frame_scanner {
+	// Frame at the head of the buffer whose header is already decoded, len 0 if none
+	struct mav_frame cur;
+	uint8_t hdr_len;
+	uint8_t sig_len;
+	uint8_t crc_extra;
+	uint16_t crc;
+	uint16_t crc_done; // frame bytes already accumulated into crc
+	bool bounded;	   // the input ends on a frame boundary, like a datagram
+
+	unsigned long frames;
+	unsigned long crc_errors;
+	unsigned long unknown_ids;
+	unsigned long skipped_bytes;
+};
+
+static struct frame_scanner serial_scanner;
+static struct frame_scanner uplink_scanner = {.bounded = true};
+
+static void iov_copy(const struct evbuffer_iovec *vec, int n, size_t pos, void *dst, size_t len) {
+	uint8_t *out = dst;
+	for (int i = 0; i < n && len > 0; i++) {
+		if (pos >= vec[i].iov_len) {
+			pos -= vec[i].iov_len;
+			continue;
+		}
+		size_t chunk = vec[i].iov_len - pos;
+		if (chunk > len)
+			chunk = len;
+		memcpy(out, (uint8_t *)vec[i].iov_base + pos, chunk);
+		out += chunk;
+		len -= chunk;
+		pos = 0;
+	}
+}
+
+static void iov_crc(
+	const struct evbuffer_iovec *vec, int n, size_t pos, size_t len, uint16_t *crc) {
+	for (int i = 0; i < n && len > 0; i++) {
+		if (pos >= vec[i].iov_len) {
+			pos -= vec[i].iov_len;
+			continue;
+		}
+		size_t chunk = vec[i].iov_len - pos;
+		if (chunk > len)
+			chunk = len;
+		crc_accumulate_buffer(crc, (const char *)vec[i].iov_base + pos, chunk);
+		len -= chunk;
+		pos = 0;
+	}
+}
+
+// Returns the position of the first 0xFE/0xFD at or after pos, or total if there is none
+static size_t iov_find_stx(const struct evbuffer_iovec *vec, int n, size_t pos, size_t total) {
+	size_t base = 0;
+	for (int i = 0; i < n; i++) {
+		size_t seg_len = vec[i].iov_len;
+		if (pos < base + seg_len) {
+			const uint8_t *p = vec[i].iov_base;
+			for (size_t j = pos > base ? pos - base : 0; j < seg_len; j++) {
+				if (p[j] == MAVLINK_STX || p[j] == MAVLINK_STX_MAVLINK1)
+					return base + j;
+			}
+		}
+		base += seg_len;
+	}
+	return total;
+}
+
+// Decodes a frame header into the scanner state, false if it can't start a frame
+static bool scan_header(struct frame_scanner *s, const uint8_t *hdr) {
+	struct mav_frame *f = &s->cur;
+
+	f->magic = hdr[0];
+	s->sig_len = 0;
+	if (f->magic == MAVLINK_STX) {
+		if (hdr[2] & ~MAVLINK_IFLAG_SIGNED)
+			return false; // incompat flag we don't understand
+		if (hdr[2] & MAVLINK_IFLAG_SIGNED)
+			s->sig_len = MAVLINK_SIGNATURE_BLOCK_LEN;
+		f->seq = hdr[4];
+		f->sysid = hdr[5];
+		f->compid = hdr[6];
+		f->msgid = hdr[7] | (hdr[8] << 8) | ((uint32_t)hdr[9] << 16);
+	} else {
+		f->seq = hdr[2];
+		f->sysid = hdr[3];
+		f->compid = hdr[4];
+		f->msgid = hdr[5];
+	}
+
+	// Frames of other dialects are still forwarded, only their CRC can't be checked
+	const mavlink_msg_entry_t *e = mavlink_get_msg_entry(f->msgid);
+	f->verified = e != NULL;
+	s->crc_extra = e ? e->crc_extra : 0;
+
+	f->len = s->hdr_len + hdr[1] + 2 + s->sig_len;
+	s->crc = X25_INIT_CRC;
+	s->crc_done = 1; // STX is not covered by the CRC
+	return true;
+}
+
+// 1 if a known frame with a good CRC starts at pos, 0 if not, -1 if it is incomplete
+static int known_frame_at(const struct evbuffer_iovec *vec, int n, size_t pos, size_t total) {
+	struct frame_scanner s = {0};
+	uint8_t hdr[MAVLINK_NUM_HEADER_BYTES];
+
+	iov_copy(vec, n, pos, hdr, 1);
+	s.hdr_len =
+		hdr[0] == MAVLINK_STX ? MAVLINK_NUM_HEADER_BYTES : MAVLINK_CORE_HEADER_MAVLINK1_LEN + 1;
+	if (total - pos < s.hdr_len)
+		return -1;
+	iov_copy(vec, n, pos, hdr, s.hdr_len);
+	if (!scan_header(&s, hdr) || !s.cur.verified)
+		return 0;
+	if (total - pos < s.cur.len)
+		return -1;
+
+	uint8_t ck[2];
+	size_t crc_pos = s.cur.len - s.sig_len - 2;
+	iov_crc(vec, n, pos + 1, crc_pos - 1, &s.crc);
+	crc_accumulate(s.crc_extra, &s.crc);
+	iov_copy(vec, n, pos + crc_pos, ck, 2);
+	return ck[0] == (s.crc & 0xFF) && ck[1] == (s.crc >> 8);
+}
+
+// Looks for a known frame inside the span of the scanner's current candidate
+static int inner_frame(
+	const struct evbuffer_iovec *vec, int n, size_t pos, size_t len, size_t total) {
+	size_t end = pos + len;
+	int ret = 0;
+
+	if (end > total)
+		end = total;
+	for (size_t p = iov_find_stx(vec, n, pos + 1, end); p < end;
+		 p = iov_find_stx(vec, n, p + 1, end)) {
+		ret = known_frame_at(vec, n, p, total);
+		if (ret != 0)
+			break;
+	}
+	return ret;
+}
+
+/// @brief Finds complete frames in the segments of a peeked evbuffer
+/// @param consumed set to the number of bytes the caller has to drain afterwards
+/// @return number of frame descriptors written to out
+static int scan_frames(struct frame_scanner *s, const struct evbuffer_iovec *vec, int n,
+	size_t total, struct mav_frame *out, int max, size_t *consumed) {
+	size_t pos = 0;
+	int count = 0;
+
+	while (count < max) {
+		if (s->cur.len == 0) {
+			size_t stx = iov_find_stx(vec, n, pos, total);
+			s->skipped_bytes += stx - pos;
+			pos = stx;
+			if (pos == total)
+				break;
+
+			uint8_t hdr[MAVLINK_NUM_HEADER_BYTES];
+			iov_copy(vec, n, pos, hdr, 1);
+			s->hdr_len = hdr[0] == MAVLINK_STX ? MAVLINK_NUM_HEADER_BYTES
+											   : MAVLINK_CORE_HEADER_MAVLINK1_LEN + 1;
+			if (total - pos < s->hdr_len)
+				break; // wait for the rest of the header
+			iov_copy(vec, n, pos, hdr, s->hdr_len);
+			if (!scan_header(s, hdr)) {
+				s->skipped_bytes++;
+				pos++;
+				continue;
+			}
+		}
+
+		struct mav_frame *f = &s->cur;
+		size_t crc_pos = f->len - s->sig_len - 2;
+		size_t avail = total - pos;
+
+		// Accumulate whatever part of the frame is here, even if it is not complete yet
+		size_t upto = avail < crc_pos ? avail : crc_pos;
+		if (upto > s->crc_done) {
+			iov_crc(vec, n, pos + s->crc_done, upto - s->crc_done, &s->crc);
+			s->crc_done = upto;
+		}
+		if (avail < f->len) {
+			// partial frame, keep it at the head of the buffer unless a
+			// candidate without CRC turns out to hide a real frame
+			if (!f->verified && inner_frame(vec, n, pos, f->len, total) > 0) {
+				s->skipped_bytes++;
+				f->len = 0;
+				pos++;
+				continue;
+			}
+			break;
+		}
+
+		bool valid;
+		if (f->verified) {
+			uint8_t ck[2];
+			iov_copy(vec, n, pos + crc_pos, ck, 2);
+			crc_accumulate(s->crc_extra, &s->crc);
+			valid = ck[0] == (s->crc & 0xFF) && ck[1] == (s->crc >> 8);
+		} else {
+			// Without CRC_EXTRA the only sanity checks left are that the next frame
+			// starts right after this one (or the input ends there, if it ends on a
+			// frame boundary) and that no real frame starts inside it.
+			if (avail == f->len && !s->bounded)
+				break;
+			uint8_t next = MAVLINK_STX;
+			if (avail > f->len)
+				iov_copy(vec, n, pos + f->len, &next, 1);
+			valid = next == MAVLINK_STX || next == MAVLINK_STX_MAVLINK1;
+			int inner = valid ? inner_frame(vec, n, pos, f->len, total) : 0;
+			if (inner < 0)
+				break; // decide once the inner candidate is complete
+			valid = valid && inner == 0;
+		}
+		if (!valid) {
+			// Not a frame after all, resync on the next STX
+			if (f->verified)
+				s->crc_errors++;
+			s->skipped_bytes++;
+			f->len = 0;
+			pos++;
+			continue;
+		}
+		if (!f->verified)
+			s->unknown_ids++;
+
+		s->frames++;
+		out[count] = *f;
+		out[count].offset = pos;
+		count++;
+		pos += f->len;
+		f->len = 0;
+	}
+
+	*consumed = pos;
+	return count;
+}
+
+// Fills the parts of a mavlink_message_t the handlers below need
+static void frame_to_message(const struct evbuffer_iovec *vec, int n, const struct mav_frame *f,
+	mavlink_message_t *message) {
+	uint8_t hdr_len =
+		f->magic == MAVLINK_STX ? MAVLINK_NUM_HEADER_BYTES : MAVLINK_CORE_HEADER_MAVLINK1_LEN + 1;
+	uint8_t len;
+
+	iov_copy(vec, n, f->offset + 1, &len, 1);
+	message->magic = f->magic;
+	message->len = len;
+	message->seq = f->seq;
+	message->sysid = f->sysid;
+	message->compid = f->compid;
+	message->msgid = f->msgid;
+	iov_copy(vec, n, f->offset + hdr_len, _MAV_PAYLOAD_NON_CONST(message), len);
+}
+
+// What used to ride along with every aggregated packet
+static void flush_extras() {
+	SendInfoToGround();
+
+	if (last_board_temp > -100) {
+		uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+		int len = SendTempToGround(buf);
+		struct frame_ref *temp_ref =
+			len > 0 ? frame_from_buffer(buf, len, MAVLINK_MSG_ID_RAW_IMU) : NULL;
+		if (temp_ref) {
+			endpoints_fanout(temp_ref);
+			frame_release(temp_ref);
+		}
+	}
+}
+
+/* Per-msgid rate limiter.
+ *
+ * Some messages come from the FC much faster than the OSD or GCS can use them
+ * over the air. A 64K entry table, indexed by msgid, points the limited ones to
+ * a token bucket of one frame that refills at the configured rate. A frame that
+ * comes too early is either dropped or, with "latest wins", kept in place of
+ * the previous early one and sent by a timer as soon as the bucket refills.
+ * Limits apply before the frames reach the endpoint queues.
+ */
+#define MAX_LIMITS 64
+#define LIMIT_TABLE_SIZE 65536
+
+enum { LIMIT_PASS, LIMIT_DROP, LIMIT_HOLD };
+
+struct msg_limit {
+	uint32_t msgid;
+	uint64_t interval_us;
+	uint64_t allow_us; // the bucket has a token again at this time
+	bool latest;	   // latest wins, otherwise early frames are dropped
+	struct frame_ref *pending;
+	struct event *ev;
+
+	unsigned long passed;
+	unsigned long suppressed;
+};
+
+static struct {
+	uint8_t index[LIMIT_TABLE_SIZE]; // msgid -> limit + 1, 0 for none
+	struct msg_limit limits[MAX_LIMITS];
+	int count;
+} rate_limits;
+
+/// @brief Adds a limit from "MSGID:HZ[:drop]", latest wins unless drop is given
+static bool rate_limit_add(const char *spec) {
+	char *end;
+	unsigned long msgid = strtoul(spec, &end, 10);
+	if (end == spec || *end != ':' || msgid >= LIMIT_TABLE_SIZE) {
+		printf("Cannot parse rate limit `%s', expected MSGID:HZ[:drop].\n", spec);
+		return false;
+	}
+	double hz = strtod(end + 1, &end);
+	if (hz <= 0 || (*end && strcmp(end, ":drop") && strcmp(end, ":latest"))) {
+		printf("Cannot parse rate limit `%s', expected MSGID:HZ[:drop].\n", spec);
+		return false;
+	}
+
+	struct msg_limit *l;
+	if (rate_limits.index[msgid])
+		l = &rate_limits.limits[rate_limits.index[msgid] - 1];
+	else if (rate_limits.count < MAX_LIMITS) {
+		l = &rate_limits.limits[rate_limits.count++];
+		rate_limits.index[msgid] = rate_limits.count;
+	} else {
+		printf("Too many rate limits, %d max\n", MAX_LIMITS);
+		return false;
+	}
+	*l = (struct msg_limit){
+		.msgid = msgid,
+		.interval_us = 1000000 / hz,
+		.latest = strcmp(end, ":drop") != 0,
+	};
+	return true;
+}
+
+// Takes the token if there is one, the next comes one interval after the last
+static bool rate_limit_take(struct msg_limit *l, uint64_t now) {
+	if (now < l->allow_us)
+		return false;
+	// keep the cadence unless the message paused for longer than an interval
+	if (now - l->allow_us < l->interval_us)
+		l->allow_us += l->interval_us;
+	else
+		l->allow_us = now + l->interval_us;
+	l->passed++;
+	return true;
+}
+
+static int rate_limit_check(uint32_t msgid) {
+	if (msgid >= LIMIT_TABLE_SIZE || !rate_limits.index[msgid])
+		return LIMIT_PASS;
+	struct msg_limit *l = &rate_limits.limits[rate_limits.index[msgid] - 1];
+
+	if (!l->pending && rate_limit_take(l, get_current_time_us()))
+		return LIMIT_PASS;
+	if (!l->latest) {
+		l->suppressed++;
+		return LIMIT_DROP;
+	}
+	return LIMIT_HOLD;
+}
+
+// Keeps an early frame, it replaces the one kept before
+static void rate_limit_hold(struct frame_ref *f) {
+	struct msg_limit *l = &rate_limits.limits[rate_limits.index[f->msgid] - 1];
+	if (l->pending) {
+		frame_release(l->pending);
+		l->suppressed++;
+	} else {
+		uint64_t now = get_current_time_us();
+		uint64_t wait = l->allow_us > now ? l->allow_us - now : 0;
+		struct timeval tv = {.tv_sec = wait / 1000000, .tv_usec = wait % 1000000};
+		evtimer_add(l->ev, &tv);
+	}
+	f->refs++;
+	l->pending = f;
+}
+
+static void rate_limit_cb(evutil_socket_t fd, short event, void *arg) {
+	(void)fd;
+	(void)event;
+	struct msg_limit *l = arg;
+	struct frame_ref *f = l->pending;
+	if (!f)
+		return;
+
+	l->pending = NULL;
+	rate_limit_take(l, l->allow_us);
+	if (endpoints_fanout(f))
+		flush_extras();
+	frame_release(f);
+}
+
+static void rate_limit_init(struct event_base *base) {
+	for (int i = 0; i < rate_limits.count; i++) {
+		struct msg_limit *l = &rate_limits.limits[i];
+		l->ev = evtimer_new(base, rate_limit_cb, l);
+		if (verbose)
+			printf("Rate limit msgid %u to %.1f Hz, %s\n", l->msgid, 1e6 / l->interval_us,
+				l->latest ? "latest wins" : "drop");
+	}
+}
+
+static void rate_limit_free() {
+	for (int i = 0; i < rate_limits.count; i++) {
+		struct msg_limit *l = &rate_limits.limits[i];
+		printf("Rate limit msgid %u %.1f Hz: %lu passed, %lu suppressed\n", l->msgid,
+			1e6 / l->interval_us, l->passed, l->suppressed);
+		if (l->pending)
+			frame_release(l->pending);
+		if (l->ev)
+			event_free(l->ev);
+	}
+}
+
+/* Recorder.
+ *
+ * --record keeps the latest frames of both directions in a ring file, meant
+ * for tmpfs, to look at after an incident. The file is allocated, mapped and
+ * faulted in once: a frame then costs a memcpy into the mapping and no
+ * syscall, and the pages are msync'ed from a timer. The records are those of
+ * a .tlog, a big endian timestamp in microseconds since the epoch followed by
+ * the frame, packed into blocks that never split a record. Each block starts
+ * with its sequence number and the length of its records, so the file is
+ * turned back into a plain .tlog by concatenating the records of the blocks
+ * in sequence order. The timestamp is read once per serial read or uplink
+ * wakeup, the frames of a read share it.
+ */
+#define RECORD_MAGIC 0x5246564d // "MVFR"
+#define RECORD_VERSION 1
+#define RECORD_HEADER_SIZE 4096
+#define RECORD_BLOCK_SIZE (64 * 1024)
+#define RECORD_SYNC_US 1000000
+
+// At the start of the file, the blocks follow
+struct record_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t block_size;
+	uint32_t block_count;
+	uint32_t reserved;
+	uint64_t created_us; // since the epoch
+};
+
+struct record_block {
+	uint32_t magic;
+	uint32_t used; // bytes of records after this header
+	uint64_t seq;  // blocks are written in this order, the oldest is overwritten
+};
+
+static struct {
+	char path[256];
+	size_t size; // of the file
+	uint8_t *map;
+	uint32_t block_count;
+	struct record_block *block; // being written
+	uint64_t seq;
+	uint64_t now_us;
+	struct event *sync_ev;
+
+	unsigned long frames;
+	unsigned long bytes;
+} record = {.size = 4096 * 1024};
+
+/// @brief Sets the recorder from "FILE[,KB]"
+static bool record_set(const char *spec) {
+	const char *comma = strrchr(spec, ',');
+	size_t len = comma ? (size_t)(comma - spec) : strlen(spec);
+	if (comma) {
+		char *end;
+		long kb = strtol(comma + 1, &end, 10);
+		if (end == comma + 1 || *end || kb <= 0) {
+			printf("Cannot parse record size `%s', expected FILE[,KB].\n", spec);
+			return false;
+		}
+		record.size = kb * 1024;
+	}
+	if (len == 0 || len >= sizeof(record.path)) {
+		printf("Cannot parse record file `%s', expected FILE[,KB].\n", spec);
+		return false;
+	}
+	memcpy(record.path, spec, len);
+	record.path[len] = 0;
+	return true;
+}
+
+static void record_stamp() {
+	if (!record.map)
+		return;
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	record.now_us = ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void record_next_block() {
+	record.seq++;
+	record.block = (struct record_block *)(record.map + RECORD_HEADER_SIZE +
+										   (record.seq % record.block_count) * RECORD_BLOCK_SIZE);
+	// emptied before it takes its new place in the sequence
+	record.block->used = 0;
+	record.block->seq = record.seq;
+	record.block->magic = RECORD_MAGIC;
+}
+
+/// @brief Appends the frame at offset of the iovecs
+static void record_frame(const struct evbuffer_iovec *vec, int n, size_t offset, size_t len) {
+	if (!record.map)
+		return;
+	size_t need = sizeof(uint64_t) + len;
+	if (sizeof(*record.block) + record.block->used + need > RECORD_BLOCK_SIZE)
+		record_next_block();
+	uint8_t *p = (uint8_t *)(record.block + 1) + record.block->used;
+	uint64_t stamp = htobe64(record.now_us);
+	memcpy(p, &stamp, sizeof(stamp));
+	iov_copy(vec, n, offset, p + sizeof(stamp), len);
+	record.block->used += need;
+	record.frames++;
+	record.bytes += need;
+}
+
+static void record_sync_cb(evutil_socket_t fd, short event, void *arg) {
+	(void)fd;
+	(void)event;
+	(void)arg;
+	if (msync(record.map, record.size, MS_ASYNC))
+		perror("msync()");
+}
+
+static bool record_init(struct event_base *base) {
+	if (!record.path[0])
+		return true;
+	record.block_count = (record.size - RECORD_HEADER_SIZE) / RECORD_BLOCK_SIZE;
+	if (record.size <= RECORD_HEADER_SIZE || record.block_count < 2) {
+		printf("Record file must be at least %d KB\n",
+			(RECORD_HEADER_SIZE + 2 * RECORD_BLOCK_SIZE) / 1024);
+		return false;
+	}
+	record.size = RECORD_HEADER_SIZE + (size_t)record.block_count * RECORD_BLOCK_SIZE;
+
+	int fd = open(record.path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		printf("Cannot open record file %s: %s\n", record.path, strerror(errno));
+		return false;
+	}
+	// allocated now, a full tmpfs can't fault the forwarding loop later
+	int ret = posix_fallocate(fd, 0, record.size);
+	if (ret) {
+		printf("Cannot allocate %zu bytes for %s: %s\n", record.size, record.path,
+			strerror(ret));
+		close(fd);
+		return false;
+	}
+	record.map = mmap(NULL, record.size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+	close(fd);
+	if (record.map == MAP_FAILED) {
+		perror("mmap()");
+		record.map = NULL;
+		return false;
+	}
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	*(struct record_header *)record.map = (struct record_header){
+		.magic = RECORD_MAGIC,
+		.version = RECORD_VERSION,
+		.header_size = RECORD_HEADER_SIZE,
+		.block_size = RECORD_BLOCK_SIZE,
+		.block_count = record.block_count,
+		.created_us = ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000,
+	};
+	record.seq = 0;
+	record.seq--; // the first block is 0
+	record_next_block();
 
-	case MAV_AUTOPILOT_PX4:
-		printf("PX4");
-		break;
+	record.sync_ev = event_new(base, -1, EV_PERSIST, record_sync_cb, NULL);
+	struct timeval tv = {.tv_sec = RECORD_SYNC_US / 1000000, .tv_usec = RECORD_SYNC_US % 1000000};
+	evtimer_add(record.sync_ev, &tv);
+	if (verbose)
+		printf("Recording to %s, %u blocks of %d KB\n", record.path, record.block_count,
+			RECORD_BLOCK_SIZE / 1024);
+	return true;
+}
 
-	default:
-		printf("other");
-		break;
+static void record_free() {
+	if (record.sync_ev)
+		event_free(record.sync_ev);
+	if (!record.map)
+		return;
+	msync(record.map, record.size, MS_SYNC);
+	munmap(record.map, record.size);
+	record.map = NULL;
+	printf("Recorded %lu frames, %lu bytes to %s, %" PRIu64 " blocks written\n", record.frames,
+		record.bytes, record.path, record.seq + 1);
+}
+
+enum { DIR_DOWN, DIR_UP, DIR_COUNT }; // serial to UDP, UDP to serial
+
+static void stats_count_msg(int dir, uint32_t msgid, size_t len);
+
+// Start of the current serial read callback
+static uint64_t serial_read_ns;
+
+static void process_mavlink(const struct evbuffer_iovec *vec, int n, const struct mav_frame *frames,
+	int count, void *arg) {
+	mavlink_message_t message;
+	for (int i = 0; i < count; ++i) {
+		const struct mav_frame *f = &frames[i];
+
+		mavpckts_ttl++;
+		stats_count_msg(DIR_DOWN, f->msgid, f->len);
+		record_frame(vec, n, f->offset, f->len);
+		system_id = f->sysid;
+		if (!version_shown) {
+			frame_to_message(vec, n, f, &message);
+			ShowVersionOnce(&message, f->magic);
+		}
+		if (verbose)
+			printf("Mavlink msg %d no: %d\n", f->msgid, f->seq);
+
+		switch (f->msgid) {
+		case MAVLINK_MSG_ID_RC_CHANNELS_RAW: // 35 Used by INAV
+			frame_to_message(vec, n, f, &message);
+			handle_msg_id_rc_channels_raw(&message);
+			break;
+
+		case MAVLINK_MSG_ID_RC_CHANNELS_OVERRIDE: // 70
+			frame_to_message(vec, n, f, &message);
+			handle_msg_id_rc_channels_override(&message);
+			break;
+
+		case MAVLINK_MSG_ID_RC_CHANNELS: // 65 used by ArduPilot
+			frame_to_message(vec, n, f, &message);
+			handle_msg_id_rc_channels(&message);
+			break;
+
+		case MAVLINK_MSG_ID_HEARTBEAT: // Msg info from the FC
+			frame_to_message(vec, n, f, &message);
+			handle_heartbeat(&message);
+			break;
+
+		case MAVLINK_MSG_ID_STATUSTEXT: // Msg info from the FC
+			// handle_statustext(&message);
+			break;
+		}
+
+		if (!parsed_endpoints)
+			continue;
+		int limit = rate_limit_check(f->msgid);
+		if (limit == LIMIT_DROP)
+			continue;
+
+		// Copy the frame once, the endpoints share it
+		struct frame_ref *ref = frame_alloc();
+		if (!ref)
+			continue;
+		iov_copy(vec, n, f->offset, ref->data, f->len);
+		ref->len = f->len;
+		ref->msgid = f->msgid;
+		latency_frame(ref, serial_read_ns);
+		if (limit == LIMIT_HOLD) {
+			rate_limit_hold(ref);
+			frame_release(ref);
+			continue;
+		}
+		bool flushed = endpoints_fanout(ref);
+		frame_release(ref);
+
+		if (flushed)
+			flush_extras();
 	}
+}
 
-	printf("\n");
+static long ttl_packets = 0; // serial read callbacks
+static long ttl_bytes = 0;
+
+/* Serial port.
+ *
+ * The usual rates go through cfsetspeed(), any other one (2M, 3M, the 1.2M
+ * and 5.25M ELRS rates...) is set with termios2 and BOTHER. --read-batch sets
+ * VMIN so the tty only reports the port readable once that many bytes are
+ * waiting, which turns many small reads into one at high rates. As the bytes
+ * of a quiet link may never reach VMIN, a timer picks them up when a read
+ * window passed without a read callback. n_tty hands reads over in 64 byte
+ * chunks and stops after the first one when VMIN is larger, so that's the max.
+ */
+#define SERIAL_READ_BUCKETS 10 // bytes per read <8, <16 ... >=2048
+#define SERIAL_MAX_VMIN 64
+#define KERNEL_NCCS 19
+#ifndef BOTHER
+#define BOTHER 0010000
+#endif
+
+#if defined(TCGETS2) && !defined(__mips__) && !defined(__powerpc__)
+// <asm/termbits.h> has it but can't be included along with <termios.h>
+struct termios2 {
+	tcflag_t c_iflag;
+	tcflag_t c_oflag;
+	tcflag_t c_cflag;
+	tcflag_t c_lflag;
+	cc_t c_line;
+	cc_t c_cc[KERNEL_NCCS];
+	speed_t c_ispeed;
+	speed_t c_ospeed;
+};
+#define HAVE_TERMIOS2
+#endif
+
+static struct {
+	int fd;
+	bool rtscts;
+	bool low_latency;
+	int vmin;		 // 0 to leave the read size to the driver
+	long window_us;	 // read window of --read-batch
+	struct event *window_ev;
+	long seen_reads; // read callbacks at the previous window
+	int reader_prio; // SCHED_FIFO priority of the reader thread, 0 not RT, -1 no thread
+	int reader_cpu;	 // CPU of the reader thread, -1 any
+
+	unsigned long window_reads; // reads done by the window timer
+	unsigned long read_sizes[SERIAL_READ_BUCKETS];
+	bool has_icount; // the driver keeps UART error counters
+	struct serial_icounter_struct icount_base;
+} serial = {.fd = -1, .reader_prio = -1, .reader_cpu = -1};
+
+/// @brief Sets the read batching from "BYTES[,US]"
+static bool serial_batch_set(const char *spec) {
+	char *end;
+	serial.vmin = strtol(spec, &end, 10);
+	if (end != spec && *end == ',')
+		serial.window_us = strtol(end + 1, &end, 10);
+	if (end == spec || *end || serial.vmin < 1 || serial.vmin > SERIAL_MAX_VMIN ||
+		serial.window_us < 0) {
+		printf("Cannot parse read batch `%s', expected BYTES[,US] with BYTES up to %d.\n", spec,
+			SERIAL_MAX_VMIN);
+		return false;
+	}
+	return true;
 }
 
-void handle_statustext(const mavlink_message_t *message) {
-	mavlink_statustext_t statustext;
-	mavlink_msg_statustext_decode(message, &statustext);
-	printf("FC message:%s", statustext.text);
+/// @brief Parses "PRIO[,CPU]" of --rt-reader
+static bool serial_reader_set(const char *spec) {
+	char *end;
+	serial.reader_prio = strtol(spec, &end, 10);
+	if (end != spec && *end == ',')
+		serial.reader_cpu = strtol(end + 1, &end, 10);
+	if (end == spec || *end || serial.reader_prio < 0 ||
+		serial.reader_prio > sched_get_priority_max(SCHED_FIFO) || serial.reader_cpu < -1) {
+		printf("Cannot parse reader thread `%s', expected PRIO[,CPU] with PRIO up to %d.\n",
+			spec, sched_get_priority_max(SCHED_FIFO));
+		return false;
+	}
+	return true;
 }
 
-unsigned long long get_current_time_ms_simple() {
-	clock_t current_clock_ticks = clock();
-	return (unsigned long long)(current_clock_ticks * 1000 / CLOCKS_PER_SEC);
+static void serial_count_read(size_t len) {
+	int bucket = len < 8 ? 0 : 63 - __builtin_clzll(len) - 2;
+	serial.read_sizes[bucket < SERIAL_READ_BUCKETS ? bucket : SERIAL_READ_BUCKETS - 1]++;
 }
 
-uint16_t channels[18];
+static bool serial_set_baudrate(int fd, int baudrate) {
+	speed_t speed = speed_by_value(baudrate);
+	if (speed) {
+		struct termios options;
+		tcgetattr(fd, &options);
+		cfsetspeed(&options, speed);
+		return tcsetattr(fd, TCSANOW, &options) == 0;
+	}
+#ifdef HAVE_TERMIOS2
+	struct termios2 tio;
+	if (ioctl(fd, TCGETS2, &tio))
+		return false;
+	tio.c_cflag &= ~CBAUD;
+	tio.c_cflag |= BOTHER;
+	tio.c_ispeed = tio.c_ospeed = baudrate;
+	if (ioctl(fd, TCSETS2, &tio) || ioctl(fd, TCGETS2, &tio))
+		return false;
+	if (tio.c_ospeed != (speed_t)baudrate)
+		printf("Baudrate %d set as %u\n", baudrate, tio.c_ospeed);
+	return true;
+#else
+	errno = EINVAL;
+	return false;
+#endif
+}
 
-// how long a RC value should stay at one level to issue a command
-static uint64_t LastStart = 0;
-static unsigned long LastValue = 0;
-uint16_t NewValue;
-static uint64_t NewValueStart = 0;
-unsigned int ChannelCmds = 0;
-static uint64_t mavpckts_ttl = 0;
+/// @brief Opens and sets up the serial port, -1 on error
+static int serial_open(const char *port_name, int baudrate) {
+	int fd = open(port_name, O_RDWR | O_NOCTTY);
+	if (fd < 0) {
+		printf("Error while openning port %s: %s\n", port_name, strerror(errno));
+		return -1;
+	};
+	evutil_make_socket_nonblocking(fd);
 
-void ProcessChannels() {
-	// ch_count , not zero based, 1 is first
-	uint16_t val = 0;
-	if (ch_count < 1 ||
-		// wait in the beginning for the values to settle
-		ch_count > 16 /* || (mavpckts_ttl<100*/)
+	// A FIFO or a file may stand in for the port (bench/compare.sh), nothing to set up
+	if (!isatty(fd)) {
+		serial.fd = fd;
+		return fd;
+	}
+
+	struct termios options;
+	tcgetattr(fd, &options);
+	cfmakeraw(&options);
+	options.c_cflag &= ~(CSIZE | PARENB | PARODD | CSTOPB); // 8N1
+	options.c_cflag |= CS8 | CLOCAL | CREAD;
+	if (serial.rtscts)
+		options.c_cflag |= CRTSCTS;
+	else
+		options.c_cflag &= ~CRTSCTS;
+	options.c_iflag = 0; // no software flow control
+	options.c_oflag = 0;
+	options.c_lflag = 0;
+	// With VTIME 0, the tty reports the port readable once VMIN bytes are there
+	options.c_cc[VMIN] = serial.vmin ? serial.vmin : 1;
+	options.c_cc[VTIME] = 0;
+	tcsetattr(fd, TCSANOW, &options);
+
+	if (!serial_set_baudrate(fd, baudrate)) {
+		printf("Cannot set baudrate %d on %s: %s\n", baudrate, port_name, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	if (serial.low_latency) {
+		// Not every driver has it, a pty doesn't
+		struct serial_struct ss;
+		if (ioctl(fd, TIOCGSERIAL, &ss) == 0) {
+			ss.flags |= ASYNC_LOW_LATENCY;
+			if (ioctl(fd, TIOCSSERIAL, &ss))
+				perror("ASYNC_LOW_LATENCY");
+		} else
+			printf("%s has no low latency mode\n", port_name);
+	}
+
+	// Overruns since open, a pty or USB serial may not count them
+	serial.has_icount = ioctl(fd, TIOCGICOUNT, &serial.icount_base) == 0;
+
+	if (verbose)
+		printf("Serial %s at %d baud%s%s, VMIN %d\n", port_name, baudrate,
+			serial.rtscts ? ", RTS/CTS" : "", serial.low_latency ? ", low latency" : "",
+			options.c_cc[VMIN]);
+	serial.fd = fd;
+	return fd;
+}
+
+/// @brief UART error counters since the port was opened, false if the driver has none
+static bool serial_icount(struct serial_icounter_struct *ic) {
+	if (!serial.has_icount || ioctl(serial.fd, TIOCGICOUNT, ic))
+		return false;
+	ic->rx -= serial.icount_base.rx;
+	ic->overrun -= serial.icount_base.overrun;
+	ic->buf_overrun -= serial.icount_base.buf_overrun;
+	ic->frame -= serial.icount_base.frame;
+	ic->parity -= serial.icount_base.parity;
+	return true;
+}
+
+static void serial_read_cb(struct bufferevent *bev, void *arg);
+
+// Reads what is left below VMIN once a read window passed without a read callback
+static void serial_window_cb(evutil_socket_t fd, short event, void *arg) {
+	(void)fd;
+	(void)event;
+	if (ttl_packets != serial.seen_reads) {
+		serial.seen_reads = ttl_packets;
 		return;
+	}
+	// the bufferevent keeps the end of its input frozen, it unfreezes it to read too
+	struct evbuffer *input = bufferevent_get_input(serial_bev);
+	evbuffer_unfreeze(input, 0);
+	int ret = evbuffer_read(input, serial.fd, -1);
+	evbuffer_freeze(input, 0);
+	if (ret > 0) {
+		serial.window_reads++;
+		serial_read_cb(serial_bev, arg);
+		serial.seen_reads = ttl_packets;
+	}
+}
 
-	if (abs(get_current_time_ms() - LastStart) < wait_after_bash)
+static void serial_init(struct event_base *base, int baudrate) {
+	if (serial.vmin <= 1)
 		return;
+	// by default twice the time VMIN bytes take on the wire
+	if (serial.window_us == 0)
+		serial.window_us = 2 * serial.vmin * 10 * 1000000LL / baudrate;
+	if (serial.reader_prio >= 0)
+		return; // the reader thread has its own window
+	serial.window_ev = event_new(base, -1, EV_PERSIST, serial_window_cb, base);
+	struct timeval tv = {
+		.tv_sec = serial.window_us / 1000000, .tv_usec = serial.window_us % 1000000};
+	evtimer_add(serial.window_ev, &tv);
+}
 
-	val = channels[ch_count - 1];
+static void serial_free() {
+	if (ttl_packets) {
+		printf("Serial %ld reads, %.1f bytes per read callback", ttl_packets,
+			(double)ttl_bytes / ttl_packets);
+		if (serial.window_ev)
+			printf(", %lu by the read window", serial.window_reads);
+		printf(":");
+		for (int i = 0; i < SERIAL_READ_BUCKETS; i++) {
+			if (!serial.read_sizes[i])
+				continue;
+			unsigned long bytes = 8UL << i;
+			if (i == SERIAL_READ_BUCKETS - 1)
+				printf(" >=%luB:%lu", bytes / 2, serial.read_sizes[i]);
+			else
+				printf(" <%luB:%lu", bytes, serial.read_sizes[i]);
+		}
+		printf("\n");
+	}
+	struct serial_icounter_struct ic;
+	if (serial_icount(&ic))
+		printf("UART %d bytes received, %d overruns, %d tty buffer overruns, %d framing and %d "
+			   "parity errors\n",
+			ic.rx, ic.overrun, ic.buf_overrun, ic.frame, ic.parity);
+	if (serial.window_ev)
+		event_free(serial.window_ev);
+}
 
-	if (abs(val - NewValue) > 32 && ChannelPersistPeriodmMS > 0) {
-		// We have a new value, let us wait for it to persist
-		NewValue = val;
-		NewValueStart = get_current_time_ms();
+// Bytes left in the serial input by the previous callback (a partial frame)
+static size_t serial_left = 0;
+// Bytes at the head of the serial input already forwarded in raw mode
+static size_t raw_forwarded = 0;
+
+static void serial_read_cb(struct bufferevent *bev, void *arg) {
+	struct evbuffer *input = bufferevent_get_input(bev);
+	struct evbuffer_iovec vec[SCAN_MAX_IOV];
+	struct mav_frame frames[SCAN_MAX_FRAMES];
+	size_t in_len = evbuffer_get_length(input);
+
+	if (in_len == 0)
 		return;
-	} else if (abs(get_current_time_ms() - NewValueStart) < ChannelPersistPeriodmMS)
-		// New value should remain "stable" for a second before being approved
+	serial_read_ns = latency_now();
+	record_stamp();
+
+	// First forward all serial input to UDP.
+	ttl_packets++;
+	ttl_bytes += in_len - serial_left;
+	serial_count_read(in_len - serial_left);
+
+	// If garbage only, give some feedback do diagnose
+	if (!version_shown && ttl_packets % 10 == 3)
+		printf("Packets:%ld  Bytes:%ld\n", ttl_packets, ttl_bytes);
+
+	// if no RC channel control or recording needed, only forward the data
+	bool parse = parsed_endpoints || ch_count > 0 || record.map;
+
+	while ((in_len = evbuffer_get_length(input))) {
+		int n = evbuffer_peek(input, -1, NULL, vec, SCAN_MAX_IOV);
+		if (n > SCAN_MAX_IOV)
+			n = SCAN_MAX_IOV;
+		size_t total = 0;
+		for (int i = 0; i < n; i++)
+			total += vec[i].iov_len;
+
+		if (raw_endpoints && total > raw_forwarded) {
+			// skip what an earlier call already sent, only a partial frame is kept back
+			endpoints_send_stream(vec, n, raw_forwarded);
+			raw_forwarded = total;
+		}
+
+		if (!parse) {
+			evbuffer_drain(input, total);
+			raw_forwarded = 0;
+			continue;
+		}
+
+		size_t consumed;
+		int count = scan_frames(&serial_scanner, vec, n, total, frames, SCAN_MAX_FRAMES, &consumed);
+		process_mavlink(vec, n, frames, count, arg);
+		evbuffer_drain(input, consumed);
+		raw_forwarded = raw_forwarded > consumed ? raw_forwarded - consumed : 0;
+
+		if (count == 0 && consumed == 0) {
+			// Only a partial frame is left. If it spans more segments than we
+			// peek, make it contiguous so that the next pass can see all of it.
+			// The pullup fails when asked for more than the buffer holds.
+			size_t want = in_len < MAVLINK_MAX_PACKET_LEN ? in_len : MAVLINK_MAX_PACKET_LEN;
+			if (total >= in_len || total >= MAVLINK_MAX_PACKET_LEN ||
+				!evbuffer_pullup(input, want))
+				break;
+		}
+	}
+	serial_left = evbuffer_get_length(input);
+}
+
+// SIGUSR1 handler
+static void sendtestmsg(evutil_socket_t fd, short event, void *arg) {
+	(void)fd;
+	(void)event;
+	(void)arg;
+	printf("Sending test mavlink msg.\n");
+	FILE *file = fopen(MavLinkMsgFile, "w");
+	if (file) {
+		fputs("Hello_From_OpenIPC\n", file);
+		fclose(file);
+	}
+	// picked up by the folder watch if there is one
+	SendInfoToGround();
+}
+
+static void serial_event_cb(struct bufferevent *bev, short events, void *arg) {
+	(void)bev;
+	struct event_base *base = arg;
+
+	if (events & (BEV_EVENT_EOF | BEV_EVENT_ERROR | BEV_EVENT_TIMEOUT)) {
+		printf("Serial connection closed\n");
+		event_base_loopbreak(base);
+	}
+}
+
+/* Serial reader thread.
+ *
+ * The event loop also runs commands, scans folders and reads the SoC
+ * temperature; while it is busy the UART bytes wait in the tty buffer, which
+ * overflows at high rates. With --rt-reader a thread of its own, SCHED_FIFO
+ * and optionally pinned to a CPU, reads the port into a single producer,
+ * single consumer ring and wakes the loop through an eventfd. The loop moves
+ * the bytes into the bufferevent input and parses them there as if the
+ * bufferevent had read them; the bufferevent still does the writes. head is
+ * only written by the thread and tail by the loop, each publishes its side
+ * with a release store after touching the ring. A full ring drops what is
+ * read (counted) rather than leaving it to overflow in the kernel.
+ */
+#define READER_RING_SIZE (256 * 1024) // power of two
+
+static struct {
+	pthread_t thread;
+	bool running;
+	int wake_fd; // eventfd, thread to loop
+	int stop_fd; // eventfd, loop to thread
+	struct event *wake_ev;
+
+	uint8_t ring[READER_RING_SIZE];
+	size_t head; // bytes written by the thread, ever
+	size_t tail; // bytes taken by the loop, ever
+	bool closed; // the port hung up or failed
+
+	// written by the thread only
+	unsigned long reads;
+	unsigned long dropped; // bytes read while the ring was full
+	size_t peak;		   // ring fill
+
+	unsigned long wakeups;
+} reader = {.wake_fd = -1, .stop_fd = -1};
+
+static void *serial_reader_main(void *arg) {
+	(void)arg;
+	struct pollfd fds[2] = {
+		{.fd = serial.fd, .events = POLLIN}, {.fd = reader.stop_fd, .events = POLLIN}};
+	// With VMIN, bytes that don't reach it are read after the read window
+	struct timespec window = {
+		.tv_sec = serial.window_us / 1000000, .tv_nsec = serial.window_us % 1000000 * 1000};
+	const struct timespec *timeout = serial.vmin > 1 ? &window : NULL;
+	uint8_t scratch[1024];
+	const uint64_t one = 1;
+
+	while (true) {
+		int ret = ppoll(fds, 2, timeout, NULL);
+		if (ret < 0 && errno != EINTR)
+			break;
+		if (fds[1].revents)
+			return NULL;
+
+		size_t head = reader.head;
+		size_t used = head - __atomic_load_n(&reader.tail, __ATOMIC_ACQUIRE);
+		size_t off = head & (READER_RING_SIZE - 1);
+		size_t room = READER_RING_SIZE - used;
+		if (room > READER_RING_SIZE - off)
+			room = READER_RING_SIZE - off;
+
+		ssize_t n = room ? read(serial.fd, reader.ring + off, room)
+						 : read(serial.fd, scratch, sizeof(scratch));
+		if (n < 0 && (errno == EAGAIN || errno == EINTR))
+			continue;
+		if (n <= 0)
+			break;
+		reader.reads++;
+		// dropped and peak are read by the statistics
+		if (!room) {
+			__atomic_store_n(&reader.dropped, reader.dropped + n, __ATOMIC_RELAXED);
+			continue;
+		}
+		if (used + n > reader.peak)
+			__atomic_store_n(&reader.peak, used + n, __ATOMIC_RELAXED);
+		__atomic_store_n(&reader.head, head + n, __ATOMIC_RELEASE);
+		if (write(reader.wake_fd, &one, sizeof(one)) < 0)
+			break;
+	}
+	__atomic_store_n(&reader.closed, true, __ATOMIC_RELEASE);
+	if (write(reader.wake_fd, &one, sizeof(one)) < 0)
+		perror("eventfd write");
+	return NULL;
+}
+
+// Moves what the thread read into the bufferevent input and parses it
+static void serial_reader_cb(evutil_socket_t fd, short event, void *arg) {
+	(void)event;
+	uint64_t count;
+	if (read(fd, &count, sizeof(count)) < 0)
 		return;
-	else {
-	} // New value persisted for more THAN ChannelPersistPeriodmMS
+	reader.wakeups++;
+
+	size_t tail = reader.tail;
+	size_t head = __atomic_load_n(&reader.head, __ATOMIC_ACQUIRE);
+	if (head != tail) {
+		struct evbuffer *input = bufferevent_get_input(serial_bev);
+		evbuffer_unfreeze(input, 0);
+		while (tail != head) {
+			size_t off = tail & (READER_RING_SIZE - 1);
+			size_t len = head - tail;
+			if (len > READER_RING_SIZE - off)
+				len = READER_RING_SIZE - off;
+			evbuffer_add(input, reader.ring + off, len);
+			tail += len;
+		}
+		evbuffer_freeze(input, 0);
+		__atomic_store_n(&reader.tail, tail, __ATOMIC_RELEASE);
+		serial_read_cb(serial_bev, arg);
+	}
+
+	if (__atomic_load_n(&reader.closed, __ATOMIC_ACQUIRE)) {
+		printf("Serial connection closed\n");
+		event_base_loopbreak(arg);
+	}
+}
+
+static bool serial_reader_start(struct event_base *base) {
+	reader.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	reader.stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (reader.wake_fd < 0 || reader.stop_fd < 0) {
+		perror("eventfd()");
+		return false;
+	}
+	reader.wake_ev =
+		event_new(base, reader.wake_fd, EV_READ | EV_PERSIST, serial_reader_cb, base);
+	event_add(reader.wake_ev, NULL);
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	if (serial.reader_prio > 0) {
+		struct sched_param param = {.sched_priority = serial.reader_prio};
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		pthread_attr_setschedparam(&attr, &param);
+	}
+	int ret = pthread_create(&reader.thread, &attr, serial_reader_main, NULL);
+	if (ret == EPERM) {
+		// Without CAP_SYS_NICE (or RLIMIT_RTPRIO), still a thread of its own
+		printf("No permission for SCHED_FIFO, serial reader thread at normal priority\n");
+		pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+		ret = pthread_create(&reader.thread, &attr, serial_reader_main, NULL);
+	}
+	pthread_attr_destroy(&attr);
+	if (ret) {
+		printf("Cannot start the serial reader thread: %s\n", strerror(ret));
+		return false;
+	}
+	reader.running = true;
+
+	if (serial.reader_cpu >= 0) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(serial.reader_cpu, &cpus);
+		ret = pthread_setaffinity_np(reader.thread, sizeof(cpus), &cpus);
+		if (ret)
+			printf("Cannot pin the serial reader to CPU %d: %s\n", serial.reader_cpu,
+				strerror(ret));
+	}
+	if (verbose)
+		printf("Serial reader thread, priority %d, CPU %d\n", serial.reader_prio,
+			serial.reader_cpu);
+	return true;
+}
+
+static void serial_reader_stop() {
+	if (reader.running) {
+		const uint64_t one = 1;
+		if (write(reader.stop_fd, &one, sizeof(one)) < 0)
+			perror("eventfd write");
+		pthread_join(reader.thread, NULL);
+		reader.running = false;
+		printf("Serial reader %lu reads, %lu loop wakeups, ring peak %zu bytes, %lu bytes "
+			   "dropped\n",
+			reader.reads, reader.wakeups, reader.peak, reader.dropped);
+	}
+	if (reader.wake_ev)
+		event_free(reader.wake_ev);
+	if (reader.wake_fd >= 0)
+		close(reader.wake_fd);
+	if (reader.stop_fd >= 0)
+		close(reader.stop_fd);
+	reader.wake_ev = NULL;
+	reader.wake_fd = reader.stop_fd = -1;
+}
+
+/* Serial output queue.
+ *
+ * Uplink frames wait here, in one queue per priority class, instead of piling
+ * up in the bufferevent: at 115200 baud a mission upload or an RTCM stream
+ * would otherwise hold a COMMAND_LONG or an RC override back for seconds. The
+ * UART is only given SERIAL_AHEAD_US of data at a time, estimated from the
+ * baudrate, and the critical queue is served first. The queues are bounded in
+ * bytes and in age: to make room the oldest bulk frames are dropped first, then
+ * the oldest of the other classes, and a frame that waited longer than the max
+ * age is dropped when its turn comes. Critical frames are never dropped.
+ */
+#define SERIAL_AHEAD_US 20000
+
+// Precedes every frame in a queue
+struct serial_out_rec {
+	uint64_t queued_us;
+	uint16_t len;
+};
+
+static struct {
+	struct evbuffer *queues[CLASS_COUNT];
+	size_t bytes[CLASS_COUNT];
+	unsigned frames[CLASS_COUNT];
+	long max_bytes;	 // -1 for half a second of the baudrate
+	long max_age_us; // 0 for no limit
+	long byte_rate;
+	uint64_t wire_free_us; // when the UART is done with what it was given
+	struct event *timer;
+
+	size_t peak_bytes;
+	unsigned long sent[CLASS_COUNT];
+	unsigned long dropped_full[CLASS_COUNT];
+	unsigned long dropped_stale[CLASS_COUNT];
+	unsigned long wait_hist[CLASS_COUNT][HOLD_HIST_BUCKETS];
+} serial_out = {.max_bytes = -1, .max_age_us = 1000000};
+
+/// @brief Sets the bounds from "BYTES[,MS]"
+static bool serial_out_set(const char *spec) {
+	char *end;
+	serial_out.max_bytes = strtol(spec, &end, 10);
+	if (end != spec && *end == ',')
+		serial_out.max_age_us = strtol(end + 1, &end, 10) * 1000;
+	if (end == spec || *end || serial_out.max_bytes < 0 || serial_out.max_age_us < 0) {
+		printf("Cannot parse uplink queue `%s', expected BYTES[,MS].\n", spec);
+		return false;
+	}
+	return true;
+}
+
+static size_t serial_out_bytes() {
+	size_t total = 0;
+	for (int c = 0; c < CLASS_COUNT; c++)
+		total += serial_out.bytes[c];
+	return total;
+}
+
+static uint8_t uplink_class(uint32_t msgid) {
+	// the pilot's inputs are as urgent as commands
+	if (msgid == MAVLINK_MSG_ID_RC_CHANNELS_OVERRIDE || msgid == MAVLINK_MSG_ID_MANUAL_CONTROL)
+		return CLASS_CRITICAL;
+	return msgid_class(msgid);
+}
+
+// Takes the record of the oldest frame of a class, its bytes are next in the queue
+static struct serial_out_rec serial_out_pop(int c) {
+	struct serial_out_rec rec;
+	evbuffer_remove(serial_out.queues[c], &rec, sizeof(rec));
+	serial_out.bytes[c] -= rec.len;
+	serial_out.frames[c]--;
+	return rec;
+}
+
+static void serial_out_pump();
+
+static void serial_out_cb(evutil_socket_t fd, short event, void *arg) {
+	(void)fd;
+	(void)event;
+	(void)arg;
+	serial_out_pump();
+}
+
+// Hands the UART what it can send in the next SERIAL_AHEAD_US, highest class first
+static void serial_out_pump() {
+	struct evbuffer *out = bufferevent_get_output(serial_bev);
+	uint64_t now = get_current_time_us();
+	if (serial_out.wire_free_us < now)
+		serial_out.wire_free_us = now;
+
+	int c = 0;
+	while (serial_out.wire_free_us < now + SERIAL_AHEAD_US) {
+		for (c = 0; c < CLASS_COUNT && !serial_out.frames[c]; c++)
+			;
+		if (c == CLASS_COUNT)
+			return;
+
+		struct serial_out_rec rec = serial_out_pop(c);
+		uint64_t waited = now - rec.queued_us;
+		if (c != CLASS_CRITICAL && serial_out.max_age_us &&
+			waited > (uint64_t)serial_out.max_age_us) {
+			evbuffer_drain(serial_out.queues[c], rec.len);
+			serial_out.dropped_stale[c]++;
+			continue;
+		}
+		evbuffer_remove_buffer(serial_out.queues[c], out, rec.len);
+		hold_hist_add(serial_out.wait_hist[c], waited);
+		serial_out.sent[c]++;
+		serial_out.wire_free_us += rec.len * 1000000 / serial_out.byte_rate;
+	}
+
+	uint64_t wait = serial_out.wire_free_us - now - SERIAL_AHEAD_US;
+	struct timeval tv = {.tv_sec = wait / 1000000, .tv_usec = wait % 1000000};
+	evtimer_add(serial_out.timer, &tv);
+}
+
+/// @brief Queues a whole frame for the serial port, dropping frames if the queue is full
+static bool serial_out_push(const uint8_t *frame, size_t len, uint32_t msgid) {
+	int c = uplink_class(msgid);
+
+	// Make room, the oldest bulk frames first, never the critical ones
+	for (int v = CLASS_BULK; v >= (c > CLASS_OSD ? c : CLASS_OSD); v--) {
+		while (serial_out.frames[v] && serial_out_bytes() + len > (size_t)serial_out.max_bytes) {
+			struct serial_out_rec rec = serial_out_pop(v);
+			evbuffer_drain(serial_out.queues[v], rec.len);
+			serial_out.dropped_full[v]++;
+		}
+	}
+	if (c != CLASS_CRITICAL && serial_out_bytes() + len > (size_t)serial_out.max_bytes) {
+		serial_out.dropped_full[c]++;
+		return false;
+	}
+
+	struct serial_out_rec rec = {.queued_us = get_current_time_us(), .len = len};
+	evbuffer_add(serial_out.queues[c], &rec, sizeof(rec));
+	evbuffer_add(serial_out.queues[c], frame, len);
+	serial_out.bytes[c] += len;
+	serial_out.frames[c]++;
+	size_t total = serial_out_bytes();
+	if (total > serial_out.peak_bytes)
+		serial_out.peak_bytes = total;
+
+	if (!evtimer_pending(serial_out.timer, NULL))
+		serial_out_pump();
+	return true;
+}
+
+static void serial_out_init(struct event_base *base, int baudrate) {
+	serial_out.byte_rate = baudrate / 10; // 8N1
+	if (serial_out.max_bytes < 0)
+		serial_out.max_bytes = serial_out.byte_rate / 2;
+	for (int c = 0; c < CLASS_COUNT; c++)
+		serial_out.queues[c] = evbuffer_new();
+	serial_out.timer = evtimer_new(base, serial_out_cb, NULL);
+	if (verbose)
+		printf("Uplink queue %ld bytes, max age %ldms\n", serial_out.max_bytes,
+			serial_out.max_age_us / 1000);
+}
+
+static void serial_out_free() {
+	if (!serial_out.timer)
+		return;
+	printf("Uplink queue peak %zu bytes, %zu left\n", serial_out.peak_bytes, serial_out_bytes());
+	for (int c = 0; c < CLASS_COUNT; c++) {
+		printf("  %-8s %lu sent, %lu dropped full, %lu dropped stale, waited:",
+			frame_classes[c].name, serial_out.sent[c], serial_out.dropped_full[c],
+			serial_out.dropped_stale[c]);
+		hold_hist_print(serial_out.wait_hist[c]);
+		evbuffer_free(serial_out.queues[c]);
+	}
+	event_free(serial_out.timer);
+}
+
+/* Uplink drain.
+ *
+ * A GCS bursts small datagrams (mission upload, param set, RTCM), so each
+ * wakeup receives up to UPLINK_BATCH of them with one recvmmsg() into a
+ * preallocated slab. Datagrams go through their own scanner: aggregated ones
+ * are split into frames, frames with a bad CRC and bytes outside frames are
+ * dropped before they take UART bandwidth, and only whole frames are queued
+ * for the serial port.
+ */
+#define UPLINK_BATCH 16
+
+static struct {
+	uint8_t slab[UPLINK_BATCH][MAX_MTU];
+	struct mmsghdr msgs[UPLINK_BATCH];
+	struct iovec iov[UPLINK_BATCH];
+
+	unsigned long wakeups;
+	unsigned long datagrams;
+	unsigned long bytes;
+	unsigned long written; // whole frames queued for the UART
+	unsigned max_batch;
+} uplink;
+
+// Queues the good frames of a datagram for the serial port
+static void uplink_frames(uint8_t *data, size_t len) {
+	struct mav_frame frames[SCAN_MAX_FRAMES];
+	size_t pos = 0;
+
+	while (pos < len) {
+		struct evbuffer_iovec vec = {.iov_base = data + pos, .iov_len = len - pos};
+		size_t consumed;
+		int count = scan_frames(&uplink_scanner, &vec, 1, len - pos, frames, SCAN_MAX_FRAMES,
+			&consumed);
+		for (int k = 0; k < count; k++) {
+			uint8_t *frame = data + pos + frames[k].offset;
+			dump_mavlink_packet(frame, "<<");
+			stats_count_msg(DIR_UP, frames[k].msgid, frames[k].len);
+			record_frame(&vec, 1, frames[k].offset, frames[k].len);
+			if (!signing_check(frame, frames[k].len))
+				continue;
+			if (serial_out_push(frame, frames[k].len, frames[k].msgid))
+				uplink.written += frames[k].len;
+		}
+		pos += consumed;
+		if (count == 0)
+			break;
+	}
+
+	// A frame cut by the end of the datagram can't be completed by the next one
+	if (pos < len) {
+		uplink_scanner.skipped_bytes += len - pos;
+		uplink_scanner.cur.len = 0;
+	}
+}
+
+static void in_read(evutil_socket_t sock, short event, void *arg) {
+	(void)event;
+	struct event_base *base = arg;
+
+	for (int i = 0; i < UPLINK_BATCH; i++) {
+		uplink.iov[i].iov_base = uplink.slab[i];
+		uplink.iov[i].iov_len = MAX_MTU - 1;
+		uplink.msgs[i].msg_hdr = (struct msghdr){
+			.msg_iov = &uplink.iov[i],
+			.msg_iovlen = 1,
+		};
+	}
+
+	int count = recvmmsg(sock, uplink.msgs, UPLINK_BATCH, MSG_DONTWAIT, NULL);
+	if (count == -1) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return;
+		perror("recvmmsg()");
+		event_base_loopbreak(base);
+		return;
+	}
+
+	uplink.wakeups++;
+	uplink.datagrams += count;
+	record_stamp();
+	if ((unsigned)count > uplink.max_batch)
+		uplink.max_batch = count;
+
+	for (int i = 0; i < count; i++) {
+		uplink.bytes += uplink.msgs[i].msg_len;
+		uplink_frames(uplink.slab[i], uplink.msgs[i].msg_len);
+	}
+}
+
+/* Replay.
+ *
+ * --replay feeds the frames of a .tlog, or of a --record ring file, to the
+ * serial input instead of a port: they go through serial_read_cb like bytes
+ * read from a UART, so parsing, aggregation, rate limits and the RC channel
+ * commands behave as in flight, and the output is the one a pty fed the same
+ * bytes gives. The frames sharing a timestamp (a read, for a recording) are
+ * handed over together. --replay-udp feeds a file to the uplink instead, as
+ * datagrams received on --in. The original timing is kept, scaled by
+ * --replay-speed; at speed 0 the frames go as fast as the loop takes them, a
+ * REPLAY_CHUNK per loop turn so that timers still run. mavfwd exits once the
+ * replays are over and the outputs and the serial port queue took what they
+ * held.
+ */
+#define REPLAY_CHUNK 4096
+
+static struct replay {
+	const char *path;
+	int dir;
+	uint8_t *data; // .tlog records
+	size_t len;
+	size_t pos;
+	size_t map_len; // of the mapped file, 0 if data is allocated
+	uint64_t first_us;
+	uint64_t start_us;
+	struct event *ev;
+
+	unsigned long frames;
+	unsigned long bytes;
+} replays[DIR_COUNT] = {{.dir = DIR_DOWN}, {.dir = DIR_UP}};
+
+static double replay_speed = 1;
+static int replays_running;
+
+static bool replay_speed_set(const char *spec) {
+	char *end;
+	replay_speed = strtod(spec, &end);
+	if (end == spec || *end || replay_speed < 0) {
+		printf("Cannot parse replay speed `%s', expected a multiplier, 0 for no pacing.\n",
+			spec);
+		return false;
+	}
+	return true;
+}
+
+/// @brief Length of the .tlog record at p, 0 if there is no whole record
+static size_t replay_record_len(const uint8_t *p, size_t avail) {
+	const uint8_t *frame = p + sizeof(uint64_t);
+	size_t len;
+	if (avail < sizeof(uint64_t) + 3)
+		return 0;
+	if (frame[0] == MAVLINK_STX_MAVLINK1)
+		len = frame[1] + MAVLINK_CORE_HEADER_MAVLINK1_LEN + 1 + MAVLINK_NUM_CHECKSUM_BYTES;
+	else if (frame[0] == MAVLINK_STX)
+		len = frame[1] + MAVLINK_NUM_NON_PAYLOAD_BYTES +
+			  (frame[2] & MAVLINK_IFLAG_SIGNED ? MAVLINK_SIGNATURE_BLOCK_LEN : 0);
+	else
+		return 0;
+	len += sizeof(uint64_t);
+	return len <= avail ? len : 0;
+}
+
+static uint64_t replay_stamp(const struct replay *r) {
+	uint64_t stamp;
+	memcpy(&stamp, r->data + r->pos, sizeof(stamp));
+	return be64toh(stamp);
+}
 
-	// the change is too small
-	if (abs(val - LastValue) < 32)
-		return;
+// The blocks of a --record ring file, in sequence order, make a .tlog
+static bool replay_unring(struct replay *r) {
+	const struct record_header *h = (const struct record_header *)r->data;
+	if (r->len < sizeof(*h) || h->magic != RECORD_MAGIC)
+		return true;
+	if (h->version != RECORD_VERSION || h->header_size < sizeof(*h) ||
+		h->block_size <= sizeof(struct record_block) ||
+		h->header_size + (uint64_t)h->block_size * h->block_count > r->len) {
+		printf("%s: unknown or damaged record file\n", r->path);
+		return false;
+	}
 
-	NewValue = val;
-	LastValue = val;
+	// blocks by sequence number, insertion sorted as they are nearly in order
+	uint32_t count = 0;
+	const struct record_block **blocks = malloc(h->block_count * sizeof(*blocks));
+	for (uint32_t i = 0; i < h->block_count; i++) {
+		const struct record_block *b =
+			(const struct record_block *)(r->data + h->header_size + (size_t)i * h->block_size);
+		if (b->magic != RECORD_MAGIC || b->used > h->block_size - sizeof(*b))
+			continue;
+		uint32_t k = count++;
+		for (; k > 0 && blocks[k - 1]->seq > b->seq; k--)
+			blocks[k] = blocks[k - 1];
+		blocks[k] = b;
+	}
 
-	char buff[60];
-	sprintf(buff, "/usr/bin/channels.sh %d %d &", ch_count, val);
+	size_t len = 0;
+	for (uint32_t i = 0; i < count; i++)
+		len += blocks[i]->used;
+	uint8_t *data = malloc(len ? len : 1);
+	len = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		memcpy(data + len, blocks[i] + 1, blocks[i]->used);
+		len += blocks[i]->used;
+	}
+	free(blocks);
 
-	printf("Starting(%d): %s n", ChannelCmds, buff);
-	LastStart = get_current_time_ms();
+	munmap(r->data, r->map_len);
+	r->map_len = 0;
+	r->data = data;
+	r->len = len;
+	return true;
+}
 
-	// intentionally skip the first command, since when stating mavfwd it
-	// will always receive some channel value and execute the script
-	if (ChannelCmds > 0) {
-		system(buff);
+static bool replay_load(struct replay *r) {
+	int fd = open(r->path, O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st)) {
+		printf("Cannot open replay file %s: %s\n", r->path, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return false;
+	}
+	r->len = r->map_len = st.st_size;
+	r->data = r->len ? mmap(NULL, r->len, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (r->data == MAP_FAILED) {
+		printf("Cannot map replay file %s: %s\n", r->path, r->len ? strerror(errno) : "empty");
+		r->data = NULL;
+		r->map_len = 0;
+		return false;
 	}
+	if (!replay_unring(r))
+		return false;
 
-	ChannelCmds++;
+	// Stop at the first thing that isn't a record
+	size_t pos = 0, len;
+	while ((len = replay_record_len(r->data + pos, r->len - pos)))
+		pos += len;
+	if (pos < r->len)
+		printf("%s: %zu bytes after offset %zu are not .tlog records, ignored\n", r->path,
+			r->len - pos, pos);
+	r->len = pos;
+	if (r->len)
+		r->first_us = replay_stamp(r);
+	return true;
 }
 
-void showchannels(int count) {
-	if (verbose) {
-		printf("Channels :");
-		for (int i = 0; i < count; i++)
-			printf("| %02d", channels[i]);
-		printf("\n");
+// Hands the records from r->pos to end over, as one serial read or as datagrams
+static void replay_deliver(struct replay *r, size_t end, struct event_base *base) {
+	uint8_t datagram[MAX_MTU];
+	size_t dlen = 0;
+	struct evbuffer *input = NULL;
+
+	if (r->dir == DIR_DOWN) {
+		input = bufferevent_get_input(serial_bev);
+		evbuffer_unfreeze(input, 0);
+	} else
+		record_stamp();
+
+	while (r->pos < end) {
+		size_t len = replay_record_len(r->data + r->pos, end - r->pos);
+		const uint8_t *frame = r->data + r->pos + sizeof(uint64_t);
+		size_t flen = len - sizeof(uint64_t);
+		r->pos += len;
+		r->frames++;
+		r->bytes += flen;
+		if (input) {
+			evbuffer_add(input, frame, flen);
+			continue;
+		}
+		if (dlen + flen > MAX_MTU - 1) {
+			uplink.datagrams++;
+			uplink.bytes += dlen;
+			uplink_frames(datagram, dlen);
+			dlen = 0;
+		}
+		memcpy(datagram + dlen, frame, flen);
+		dlen += flen;
+	}
+
+	if (input) {
+		evbuffer_freeze(input, 0);
+		serial_read_cb(serial_bev, base);
+	} else if (dlen) {
+		uplink.datagrams++;
+		uplink.bytes += dlen;
+		uplink_frames(datagram, dlen);
 	}
 }
 
-void handle_msg_id_rc_channels_raw(const mavlink_message_t *message) {
-	mavlink_rc_channels_raw_t rc_channels;
-	mavlink_msg_rc_channels_raw_decode(message, &rc_channels);
-	memcpy(&channels[0], &rc_channels.chan1_raw, 8 * sizeof(uint16_t));
-	showchannels(8);
-	ProcessChannels();
+// Exits once the outputs and the serial port took everything
+static void replay_finish(evutil_socket_t fd, short event, void *arg) {
+	(void)fd;
+	(void)event;
+	struct event_base *base = arg;
+	for (int i = 0; i < endpoint_count; i++)
+		endpoint_flush(&endpoints[i]);
+	egress_flush();
+	if (serial_out_bytes() || evbuffer_get_length(bufferevent_get_output(serial_bev))) {
+		struct timeval tv = {.tv_usec = 10000};
+		event_base_once(base, -1, EV_TIMEOUT, replay_finish, base, &tv);
+		return;
+	}
+	event_base_loopbreak(base);
 }
 
-void handle_msg_id_rc_channels_override(const mavlink_message_t *message) {
-	mavlink_rc_channels_override_t rc_channels;
-	mavlink_msg_rc_channels_override_decode(message, &rc_channels);
-	memcpy(&channels[0], &rc_channels.chan1_raw, 18 * sizeof(uint16_t));
-	showchannels(18);
-	ProcessChannels();
+static void replay_done(struct replay *r, struct event_base *base) {
+	printf("Replayed %lu frames, %lu bytes of %s in %.3fs\n", r->frames, r->bytes, r->path,
+		(get_current_time_us() - r->start_us) / 1e6);
+	if (--replays_running == 0)
+		replay_finish(-1, 0, base);
 }
 
-void handle_msg_id_rc_channels(const mavlink_message_t *message) {
-	mavlink_rc_channels_t rc_channels;
-	mavlink_msg_rc_channels_decode(message, &rc_channels);
-	memcpy(&channels[0], &rc_channels.chan1_raw, 18 * sizeof(uint16_t));
-	showchannels(18);
-	ProcessChannels();
+static void replay_cb(evutil_socket_t fd, short event, void *arg) {
+	(void)fd;
+	(void)event;
+	struct replay *r = arg;
+	struct event_base *base = event_get_base(r->ev);
+	uint64_t now = get_current_time_us();
+
+	while (r->pos < r->len) {
+		size_t end = r->pos;
+		if (replay_speed == 0) {
+			// a chunk per loop turn
+			while (end < r->len && end - r->pos < REPLAY_CHUNK)
+				end += replay_record_len(r->data + end, r->len - end);
+			replay_deliver(r, end, base);
+			struct timeval tv = {0};
+			evtimer_add(r->ev, &tv);
+			return;
+		}
+
+		uint64_t stamp = replay_stamp(r);
+		uint64_t due =
+			r->start_us + (stamp > r->first_us ? (stamp - r->first_us) / replay_speed : 0);
+		if (due > now) {
+			uint64_t wait = due - now;
+			struct timeval tv = {.tv_sec = wait / 1000000, .tv_usec = wait % 1000000};
+			evtimer_add(r->ev, &tv);
+			return;
+		}
+		// the records of a read share their timestamp
+		do
+			end += replay_record_len(r->data + end, r->len - end);
+		while (end < r->len && end - r->pos < MAX_MTU - MAVLINK_MAX_PACKET_LEN &&
+			   memcmp(r->data + end, r->data + r->pos, sizeof(uint64_t)) == 0);
+		replay_deliver(r, end, base);
+	}
+	replay_done(r, base);
 }
 
-unsigned char mavbuf[2048];
-unsigned int mavbuff_offset = 0;
-unsigned int mavpckts_count = 0;
+static bool replay_init(struct event_base *base) {
+	for (int d = 0; d < DIR_COUNT; d++) {
+		struct replay *r = &replays[d];
+		if (!r->path)
+			continue;
+		if (!replay_load(r))
+			return false;
+		printf("Replaying %s to the %s", r->path, d == DIR_DOWN ? "outputs" : "serial port");
+		if (replay_speed == 0)
+			printf(" as fast as possible\n");
+		else
+			printf(" at %g times the recorded pace\n", replay_speed);
+		r->ev = evtimer_new(base, replay_cb, r);
+		r->start_us = get_current_time_us();
+		struct timeval tv = {0};
+		evtimer_add(r->ev, &tv);
+		replays_running++;
+	}
+	return true;
+}
 
-static void process_mavlink(uint8_t *buffer, int count, void *arg) {
-	mavlink_message_t message;
-	mavlink_status_t status;
-	for (int i = 0; i < count; ++i) {
-		if (mavbuff_offset > 2000) {
-			printf("Mavlink buffer overflowed! Packed lost!\n");
-			mavbuff_offset = 0;
-		}
-
-		mavbuf[mavbuff_offset] = buffer[i];
-		mavbuff_offset++;
-		if (mavlink_parse_char(MAVLINK_COMM_0, buffer[i], &message, &status) == 1) {
-			mavpckts_ttl++;
-			system_id = message.sysid;
-			ShowVersionOnce(&message, (uint8_t)buffer[0]);
-			if (verbose)
-				printf("Mavlink msg %d no: %d\n", message.msgid, message.seq);
-
-			switch (message.msgid) {
-			case MAVLINK_MSG_ID_RC_CHANNELS_RAW: // 35 Used by INAV
-				handle_msg_id_rc_channels_raw(&message);
-				break;
+static void replay_free() {
+	for (int d = 0; d < DIR_COUNT; d++) {
+		struct replay *r = &replays[d];
+		if (r->ev)
+			event_free(r->ev);
+		if (r->map_len)
+			munmap(r->data, r->map_len);
+		else
+			free(r->data);
+	}
+}
 
-			case MAVLINK_MSG_ID_RC_CHANNELS_OVERRIDE: // 70
-				handle_msg_id_rc_channels_override(&message);
-				break;
+/* Statistics.
+ *
+ * The forwarding path only bumps counters in the structures it already
+ * touches. They are collected into one stats page: --stats-shm maps the page
+ * from a file (e.g. in /dev/shm) and republishes it every STATS_PERIOD_US under
+ * a seqlock, so a monitor reads it without the loop making a single syscall
+ * for it. The writer makes the sequence odd, updates the page and makes it
+ * even again; a reader copies the page and retries while the sequence was odd
+ * or changed during the copy. --stats serves the same figures as one JSON
+ * document to every client of a Unix stream socket.
+ */
+#define STATS_MAGIC 0x5346564d // "MVFS"
+#define STATS_VERSION 5
+#define STATS_PERIOD_US 100000
+// every message of the dialect, the last slot counts the unknown ones
+#define STATS_MSGIDS (sizeof(mavlink_message_crcs) / sizeof(mavlink_message_crcs[0]) + 1)
+#define STATS_UNKNOWN_MSGID 0xFFFFFFFF
+
+struct stats_dir {
+	uint64_t frames;
+	uint64_t bytes;
+	uint64_t datagrams;
+	uint64_t crc_errors;
+	uint64_t unknown_ids;
+	uint64_t skipped_bytes;
+};
 
-			case MAVLINK_MSG_ID_RC_CHANNELS: // 65 used by ArduPilot
-				handle_msg_id_rc_channels(&message);
-				break;
+struct stats_endpoint {
+	char name[32];
+	uint64_t frames;
+	uint64_t bytes;
+	uint64_t filtered;
+	uint64_t limited;
+	uint64_t dropped; // class queue overflows
+	uint64_t deadline_flushes;
+	uint64_t send_errors;
+	uint64_t packed; // envelopes, with the bytes of their datagrams and of themselves
+	uint64_t packed_in;
+	uint64_t packed_out;
+	uint64_t pack_ns;
+	uint64_t fec_data; // datagrams sent in fec groups, and their parity
+	uint64_t fec_parity;
+	uint64_t fec_ns;
+};
 
-			case MAVLINK_MSG_ID_HEARTBEAT: // Msg info from the FC
-				handle_heartbeat(&message);
-				break;
+struct stats_serial_queue {
+	uint64_t bytes;
+	uint64_t frames;
+	uint64_t peak_bytes;
+	uint64_t sent[CLASS_COUNT];
+	uint64_t dropped_full[CLASS_COUNT];
+	uint64_t dropped_stale[CLASS_COUNT];
+	uint64_t wait_hist[CLASS_COUNT][HOLD_HIST_BUCKETS]; // <128us, <256us ... >=131ms
+};
 
-			case MAVLINK_MSG_ID_STATUSTEXT: // Msg info from the FC
-				// handle_statustext(&message);
-				break;
-			}
+// UART counters since open (when the driver has them) and the reader thread ring
+struct stats_serial_port {
+	uint32_t has_icount;
+	uint32_t reader_thread;
+	uint64_t rx;
+	uint64_t overruns;	   // the UART FIFO overflowed
+	uint64_t buf_overruns; // the tty buffer overflowed
+	uint64_t frame_errors;
+	uint64_t parity_errors;
+	uint64_t reader_dropped; // bytes read while the ring was full
+	uint64_t reader_peak;
+};
 
-			mavpckts_count++;
-			if (aggregate > 0) {
-				// We will send whole packets only if packets more than treshold
-				if (((aggregate >= 1 && aggregate < 50) && mavpckts_count >= aggregate) ||
-					// if buffer more than treshold MAVLINK_MSG_ID_ATTITUDE will always cause the buffer flushed
-					((aggregate > 50 && aggregate < 2000) && mavbuff_offset >= aggregate) ||
-						((mavpckts_count >= 3) && message.msgid == MAVLINK_MSG_ID_ATTITUDE)) {
-					// flush and send all data
-					if (sendto(out_sock, mavbuf, mavbuff_offset, 0, (struct sockaddr *)&sin_out,
-							sizeof(sin_out)) == -1) {
-						perror("sendto()");
-						// event_base_loopbreak(arg);
-					}
-
-					if (verbose)
-						printf("%d Pckts / %d bytes sent\n", mavpckts_count, mavbuff_offset);
-
-					mavbuff_offset = 0;
-					mavpckts_count = 0;
-
-					SendInfoToGround();
-					SendWfbLogToGround();
-
-					if (last_board_temp > -100) {
-						mavbuff_offset = SendTempToGround(mavbuf);
-					}
-
-					if (mavbuff_offset > 0) {
-						mavpckts_count++;
-					}
-				}
-			}
-		} // if mavlink_parse_char
-	}
+struct stats_msg {
+	uint32_t msgid;
+	uint32_t reserved;
+	uint64_t frames[DIR_COUNT];
+	uint64_t bytes[DIR_COUNT];
+};
+
+// Layout of the shared page, readers check magic, version and size
+struct stats_page {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t seq; // odd while the page is updated
+	uint32_t size;
+	uint64_t uptime_us;
+
+	struct stats_dir dir[DIR_COUNT];
+	uint64_t pool_exhausted; // frames lost for want of a free slot
+	uint64_t queue_drops;	 // frames lost to full endpoint queues
+	uint64_t rate_suppressed;
+	uint64_t syscalls;
+	uint64_t send_errors;
+	uint64_t flush_sizes[EGRESS_SIZE_BUCKETS];
+	struct stats_serial_queue serial_queue;
+	struct stats_serial_port serial_port;
+
+	uint32_t endpoint_count;
+	uint32_t msg_count;
+	struct stats_endpoint endpoints[MAX_ENDPOINTS];
+	struct stats_msg msgs[STATS_MSGIDS];
+};
+
+static struct {
+	struct stats_msg msgs[STATS_MSGIDS];
+	uint64_t start_us;
+
+	const char *shm_path;
+	struct stats_page *shm;
+	struct event *timer;
+
+	const char *sock_path;
+	struct evconnlistener *listener;
+} stats;
+
+static void stats_count_msg(int dir, uint32_t msgid, size_t len) {
+	const mavlink_msg_entry_t *e = mavlink_get_msg_entry(msgid);
+	struct stats_msg *m = &stats.msgs[e ? (size_t)(e - mavlink_message_crcs) : STATS_MSGIDS - 1];
+	m->frames[dir]++;
+	m->bytes[dir] += len;
 }
 
-static long ttl_packets = 0;
-static long ttl_bytes = 0;
+// Gathers the counters of every subsystem into a page
+static void stats_collect(struct stats_page *p) {
+	p->magic = STATS_MAGIC;
+	p->version = STATS_VERSION;
+	p->size = sizeof(*p);
+	p->uptime_us = get_current_time_us() - stats.start_us;
+
+	p->dir[DIR_DOWN] = (struct stats_dir){
+		.frames = serial_scanner.frames,
+		.bytes = ttl_bytes,
+		.datagrams = egress.datagrams,
+		.crc_errors = serial_scanner.crc_errors,
+		.unknown_ids = serial_scanner.unknown_ids,
+		.skipped_bytes = serial_scanner.skipped_bytes,
+	};
+	p->dir[DIR_UP] = (struct stats_dir){
+		.frames = uplink_scanner.frames,
+		.bytes = uplink.bytes,
+		.datagrams = uplink.datagrams,
+		.crc_errors = uplink_scanner.crc_errors,
+		.unknown_ids = uplink_scanner.unknown_ids,
+		.skipped_bytes = uplink_scanner.skipped_bytes,
+	};
+	p->pool_exhausted = frame_pool.exhausted;
+	p->syscalls = egress.syscalls;
+	p->send_errors = egress.errors;
+	memcpy(p->flush_sizes, egress.sizes, sizeof(p->flush_sizes));
+
+	struct stats_serial_queue *sq = &p->serial_queue;
+	sq->bytes = serial_out_bytes();
+	sq->frames = 0;
+	sq->peak_bytes = serial_out.peak_bytes;
+	for (int c = 0; c < CLASS_COUNT; c++) {
+		sq->frames += serial_out.frames[c];
+		sq->sent[c] = serial_out.sent[c];
+		sq->dropped_full[c] = serial_out.dropped_full[c];
+		sq->dropped_stale[c] = serial_out.dropped_stale[c];
+		for (int i = 0; i < HOLD_HIST_BUCKETS; i++)
+			sq->wait_hist[c][i] = serial_out.wait_hist[c][i];
+	}
 
-static void serial_read_cb(struct bufferevent *bev, void *arg) {
-	struct evbuffer *input = bufferevent_get_input(bev);
-	int packet_len, in_len;
-	struct event_base *base = arg;
+	// an ioctl, but from the stats timer, not the forwarding path
+	struct serial_icounter_struct ic;
+	struct stats_serial_port *sp = &p->serial_port;
+	sp->has_icount = serial_icount(&ic);
+	if (sp->has_icount) {
+		sp->rx = ic.rx;
+		sp->overruns = ic.overrun;
+		sp->buf_overruns = ic.buf_overrun;
+		sp->frame_errors = ic.frame;
+		sp->parity_errors = ic.parity;
+	}
+	sp->reader_thread = reader.running;
+	sp->reader_dropped = __atomic_load_n(&reader.dropped, __ATOMIC_RELAXED);
+	sp->reader_peak = __atomic_load_n(&reader.peak, __ATOMIC_RELAXED);
+
+	p->queue_drops = 0;
+	p->endpoint_count = endpoint_count;
+	for (int i = 0; i < endpoint_count; i++) {
+		const struct endpoint *ep = &endpoints[i];
+		struct stats_endpoint *s = &p->endpoints[i];
+		memcpy(s->name, ep->name, sizeof(s->name));
+		s->frames = ep->frames;
+		s->bytes = ep->bytes;
+		s->filtered = ep->filtered;
+		s->limited = ep->limited;
+		s->dropped = 0;
+		for (int c = 0; c < CLASS_COUNT; c++)
+			s->dropped += ep->queues[c].dropped;
+		s->deadline_flushes = ep->deadline_flushes;
+		s->send_errors = ep->errors;
+		s->packed = ep->packed;
+		s->packed_in = ep->packed_in;
+		s->packed_out = ep->packed_out;
+		s->pack_ns = ep->pack_ns;
+		s->fec_data = ep->fec ? ep->fec->data : 0;
+		s->fec_parity = ep->fec ? ep->fec->parity : 0;
+		s->fec_ns = ep->fec ? ep->fec->ns : 0;
+		p->queue_drops += s->dropped;
+	}
 
-	while ((in_len = evbuffer_get_length(input))) {
-		unsigned char *data = evbuffer_pullup(input, in_len);
-		if (data == NULL) {
-			return;
-		}
-		packet_len = in_len;
+	p->rate_suppressed = 0;
+	for (int i = 0; i < rate_limits.count; i++)
+		p->rate_suppressed += rate_limits.limits[i].suppressed;
 
-		// First forward all serial input to UDP.
-		ttl_packets++;
-		ttl_bytes += packet_len;
+	p->msg_count = STATS_MSGIDS;
+	for (size_t i = 0; i < STATS_MSGIDS; i++) {
+		p->msgs[i] = stats.msgs[i];
+		p->msgs[i].msgid =
+			i < STATS_MSGIDS - 1 ? mavlink_message_crcs[i].msgid : STATS_UNKNOWN_MSGID;
+	}
+}
 
-		// If garbage only, give some feedback do diagnose
-		if (!version_shown && ttl_packets % 10 == 3)
-			printf("Packets:%ld  Bytes:%ld\n", ttl_packets, ttl_bytes);
+static void stats_publish(evutil_socket_t fd, short event, void *arg) {
+	(void)fd;
+	(void)event;
+	(void)arg;
+	struct stats_page *p = stats.shm;
 
-		if (aggregate == 0) {
-			if (sendto(out_sock, data, packet_len, 0, (struct sockaddr *)&sin_out,
-					sizeof(sin_out)) == -1) {
-				perror("sendto()");
-				// event_base_loopbreak(base);
-			}
-		}
+	__atomic_store_n(&p->seq, p->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	stats_collect(p);
+	__atomic_store_n(&p->seq, p->seq + 1, __ATOMIC_RELEASE);
+}
+
+static void stats_json_dir(struct evbuffer *out, const char *name, const struct stats_dir *d) {
+	evbuffer_add_printf(out,
+		"\"%s\":{\"frames\":%" PRIu64 ",\"bytes\":%" PRIu64 ",\"datagrams\":%" PRIu64
+		",\"crc_errors\":%" PRIu64 ",\"unknown_ids\":%" PRIu64 ",\"skipped_bytes\":%" PRIu64 "},",
+		name, d->frames, d->bytes, d->datagrams, d->crc_errors, d->unknown_ids, d->skipped_bytes);
+}
 
-		// Let's try to parse the stream
-		// if no RC channel control needed, only forward the data
-		if (aggregate > 0 || ch_count > 0)
-			// Let's try to parse the stream
-			process_mavlink(data, packet_len, arg);
+static void stats_json(struct evbuffer *out, const struct stats_page *p) {
+	evbuffer_add_printf(out, "{\"uptime_us\":%" PRIu64 ",", p->uptime_us);
+	stats_json_dir(out, "down", &p->dir[DIR_DOWN]);
+	stats_json_dir(out, "up", &p->dir[DIR_UP]);
+	latency_json(out);
+	evbuffer_add_printf(out,
+		"\"pool_exhausted\":%" PRIu64 ",\"queue_drops\":%" PRIu64 ",\"rate_suppressed\":%" PRIu64
+		",\"syscalls\":%" PRIu64 ",\"send_errors\":%" PRIu64 ",\"flush_sizes\":{",
+		p->pool_exhausted, p->queue_drops, p->rate_suppressed, p->syscalls, p->send_errors);
+	for (int i = 0; i < EGRESS_SIZE_BUCKETS; i++) {
+		unsigned long bytes = 64UL << i;
+		if (i == EGRESS_SIZE_BUCKETS - 1)
+			evbuffer_add_printf(out, "\">=%lu\":%" PRIu64 "},", bytes / 2, p->flush_sizes[i]);
+		else
+			evbuffer_add_printf(out, "\"<%lu\":%" PRIu64 ",", bytes, p->flush_sizes[i]);
+	}
+
+	const struct stats_serial_queue *sq = &p->serial_queue;
+	evbuffer_add_printf(out,
+		"\"serial_queue\":{\"bytes\":%" PRIu64 ",\"frames\":%" PRIu64 ",\"peak_bytes\":%" PRIu64,
+		sq->bytes, sq->frames, sq->peak_bytes);
+	for (int c = 0; c < CLASS_COUNT; c++) {
+		evbuffer_add_printf(out,
+			",\"%s\":{\"sent\":%" PRIu64 ",\"dropped_full\":%" PRIu64
+			",\"dropped_stale\":%" PRIu64 ",\"wait_us\":{",
+			frame_classes[c].name, sq->sent[c], sq->dropped_full[c], sq->dropped_stale[c]);
+		for (int i = 0; i < HOLD_HIST_BUCKETS; i++) {
+			unsigned long us = 128UL << i;
+			if (i == HOLD_HIST_BUCKETS - 1)
+				evbuffer_add_printf(out, "\">=%lu\":%" PRIu64 "}}", us / 2, sq->wait_hist[c][i]);
+			else
+				evbuffer_add_printf(out, "\"<%lu\":%" PRIu64 ",", us, sq->wait_hist[c][i]);
+		}
+	}
+	const struct stats_serial_port *sp = &p->serial_port;
+	evbuffer_add_printf(
+		out, "},\"serial_port\":{\"icount\":%s", sp->has_icount ? "true" : "false");
+	if (sp->has_icount)
+		evbuffer_add_printf(out,
+			",\"rx\":%" PRIu64 ",\"overruns\":%" PRIu64 ",\"buf_overruns\":%" PRIu64
+			",\"frame_errors\":%" PRIu64 ",\"parity_errors\":%" PRIu64,
+			sp->rx, sp->overruns, sp->buf_overruns, sp->frame_errors, sp->parity_errors);
+	evbuffer_add_printf(out,
+		",\"reader_thread\":%s,\"reader_dropped\":%" PRIu64 ",\"reader_peak\":%" PRIu64,
+		sp->reader_thread ? "true" : "false", sp->reader_dropped, sp->reader_peak);
+	evbuffer_add_printf(out, "},\"endpoints\":[");
+	for (uint32_t i = 0; i < p->endpoint_count; i++) {
+		const struct stats_endpoint *s = &p->endpoints[i];
+		evbuffer_add_printf(out,
+			"%s{\"name\":\"%s\",\"frames\":%" PRIu64 ",\"bytes\":%" PRIu64 ",\"filtered\":%" PRIu64
+			",\"limited\":%" PRIu64 ",\"dropped\":%" PRIu64 ",\"deadline_flushes\":%" PRIu64
+			",\"send_errors\":%" PRIu64 ",\"packed\":%" PRIu64 ",\"packed_in\":%" PRIu64
+			",\"packed_out\":%" PRIu64 ",\"pack_ns\":%" PRIu64 ",\"fec_data\":%" PRIu64
+			",\"fec_parity\":%" PRIu64 ",\"fec_ns\":%" PRIu64 "}",
+			i ? "," : "", s->name, s->frames, s->bytes, s->filtered, s->limited, s->dropped,
+			s->deadline_flushes, s->send_errors, s->packed, s->packed_in, s->packed_out, s->pack_ns,
+			s->fec_data, s->fec_parity, s->fec_ns);
+	}
 
-		evbuffer_drain(input, packet_len);
+	// only the messages seen so far
+	evbuffer_add_printf(out, "],\"msgids\":[");
+	bool first = true;
+	for (uint32_t i = 0; i < p->msg_count; i++) {
+		const struct stats_msg *m = &p->msgs[i];
+		if (!m->frames[DIR_DOWN] && !m->frames[DIR_UP])
+			continue;
+		if (m->msgid == STATS_UNKNOWN_MSGID)
+			evbuffer_add_printf(out, "%s{\"msgid\":null", first ? "" : ",");
+		else
+			evbuffer_add_printf(out, "%s{\"msgid\":%u", first ? "" : ",", m->msgid);
+		evbuffer_add_printf(out,
+			",\"down_frames\":%" PRIu64 ",\"down_bytes\":%" PRIu64 ",\"up_frames\":%" PRIu64
+			",\"up_bytes\":%" PRIu64 "}",
+			m->frames[DIR_DOWN], m->bytes[DIR_DOWN], m->frames[DIR_UP], m->bytes[DIR_UP]);
+		first = false;
 	}
+	evbuffer_add_printf(out, "]}\n");
 }
 
-// Signal handler function
-void sendtestmsg(int signum) {
-	printf("Sending test mavlink msg.\n");
-	char buff[200];
-	sprintf(buff, "echo Hello_From_OpenIPC > %s", MavLinkMsgFile);
-	system(buff);
-	SendInfoToGround();
+static void stats_client_cb(struct bufferevent *bev, void *arg) {
+	(void)arg;
+	bufferevent_free(bev);
 }
 
-static void serial_event_cb(struct bufferevent *bev, short events, void *arg) {
-	(void)bev;
-	struct event_base *base = arg;
+static void stats_client_event_cb(struct bufferevent *bev, short events, void *arg) {
+	(void)events;
+	(void)arg;
+	bufferevent_free(bev);
+}
 
-	if (events & (BEV_EVENT_EOF | BEV_EVENT_ERROR | BEV_EVENT_TIMEOUT)) {
-		printf("Serial connection closed\n");
-		event_base_loopbreak(base);
+// Every client gets one document, the connection is closed once it is written
+static void stats_accept_cb(struct evconnlistener *listener, evutil_socket_t fd,
+	struct sockaddr *addr, int socklen, void *arg) {
+	(void)addr;
+	(void)socklen;
+	(void)arg;
+	static struct stats_page page;
+
+	struct bufferevent *bev = bufferevent_socket_new(
+		evconnlistener_get_base(listener), fd, BEV_OPT_CLOSE_ON_FREE);
+	if (!bev) {
+		close(fd);
+		return;
 	}
+	stats_collect(&page);
+	stats_json(bufferevent_get_output(bev), &page);
+	bufferevent_setcb(bev, NULL, stats_client_cb, stats_client_event_cb, NULL);
+	bufferevent_enable(bev, EV_WRITE);
 }
 
-static void in_read(evutil_socket_t sock, short event, void *arg) {
-	(void)event;
-	unsigned char buf[MAX_MTU];
-	struct event_base *base = arg;
-	ssize_t nread;
+static void stats_init(struct event_base *base) {
+	stats.start_us = get_current_time_us();
 
-	nread = recvfrom(sock, &buf, sizeof(buf) - 1, 0, NULL, NULL);
-	if (nread == -1) {
-		perror("recvfrom()");
-		event_base_loopbreak(base);
+	if (stats.shm_path) {
+		int fd = open(stats.shm_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0 || ftruncate(fd, sizeof(struct stats_page))) {
+			printf("Cannot create stats page %s: %s\n", stats.shm_path, strerror(errno));
+		} else {
+			void *p = mmap(NULL, sizeof(struct stats_page), PROT_READ | PROT_WRITE, MAP_SHARED,
+				fd, 0);
+			if (p == MAP_FAILED)
+				perror("mmap()");
+			else {
+				stats.shm = p;
+				stats.timer = event_new(base, -1, EV_PERSIST, stats_publish, NULL);
+				evtimer_add(stats.timer, &(struct timeval){.tv_usec = STATS_PERIOD_US});
+				stats_publish(-1, 0, NULL);
+			}
+		}
+		if (fd >= 0)
+			close(fd);
 	}
 
-	if (nread > 6) {
-		dump_mavlink_packet(buf, "<<");
-		bufferevent_write(serial_bev, buf, nread);
+	if (stats.sock_path) {
+		struct sockaddr_un sun = {.sun_family = AF_UNIX};
+		if (strlen(stats.sock_path) >= sizeof(sun.sun_path)) {
+			printf("Stats socket path %s too long\n", stats.sock_path);
+			return;
+		}
+		strcpy(sun.sun_path, stats.sock_path);
+		unlink(stats.sock_path);
+		stats.listener = evconnlistener_new_bind(base, stats_accept_cb, NULL,
+			LEV_OPT_CLOSE_ON_FREE | LEV_OPT_CLOSE_ON_EXEC, -1, (struct sockaddr *)&sun,
+			sizeof(sun));
+		if (!stats.listener)
+			printf("Cannot listen on %s: %s\n", stats.sock_path, strerror(errno));
+		else if (verbose)
+			printf("Stats on %s\n", stats.sock_path);
+	}
+}
+
+static void stats_free() {
+	if (stats.timer)
+		event_free(stats.timer);
+	if (stats.shm) {
+		munmap(stats.shm, sizeof(struct stats_page));
+		unlink(stats.shm_path);
+	}
+	if (stats.listener) {
+		evconnlistener_free(stats.listener);
+		unlink(stats.sock_path);
 	}
 }
 
@@ -757,43 +5069,180 @@ static void temp_read(evutil_socket_t sock, short event, void *arg) {
 	last_board_temp = tempo;
 }
 
-static int handle_data(
-	const char *port_name, int baudrate, const char *out_addr, const char *in_addr) {
+/* Ground decoder.
+ *
+ * mavfwd --decode runs on the ground, between the telemetry link and the GCS.
+ * There is no serial port: the datagrams of fec groups received on --in are
+ * passed on as they come and the lost ones rebuilt once the group has enough
+ * parity, then each datagram is opened if it is an envelope and sent on to
+ * every --out as plain MAVLink, one datagram for one. Other datagrams pass as
+ * they are, so the air side may pack some outputs and not others. Broken
+ * envelopes are dropped. The outputs are sent
+ * from a socket of their own, what the GCS sends back isn't carried: its
+ * uplink goes to the air side as without envelopes.
+ */
+static struct {
+	unsigned long datagrams;
+	unsigned long envelopes;
+	unsigned long broken;
+	unsigned long packed_bytes; // of the envelopes, and of what they held
+	unsigned long unpacked_bytes;
+	uint64_t ns;
+} decoder;
+
+// Sends a datagram, out of its envelope, to the outputs
+static void decode_deliver(const uint8_t *data, size_t len) {
+	if (len > 0 && data[0] == ENVELOPE_MAGIC) {
+		size_t packed = len;
+		uint64_t start = get_current_time_ns();
+		data = envelope_unpack(data, len, &len);
+		if (!data) {
+			decoder.broken++;
+			return;
+		}
+		decoder.ns += get_current_time_ns() - start;
+		decoder.envelopes++;
+		decoder.packed_bytes += packed;
+		decoder.unpacked_bytes += len;
+	}
+	for (int e = 0; e < endpoint_count; e++) {
+		struct endpoint *ep = &endpoints[e];
+		uint8_t *buf = egress_reserve(&ep->addr, len, false);
+		if (!buf)
+			continue;
+		memcpy(buf, data, len);
+		ep->frames++;
+		ep->bytes += len;
+	}
+}
+
+static void decode_read(evutil_socket_t sock, short event, void *arg) {
+	(void)event;
+	struct event_base *base = arg;
+
+	// the uplink slab is free, there is no uplink here
+	for (int i = 0; i < UPLINK_BATCH; i++) {
+		uplink.iov[i].iov_base = uplink.slab[i];
+		uplink.iov[i].iov_len = MAX_MTU;
+		uplink.msgs[i].msg_hdr = (struct msghdr){
+			.msg_iov = &uplink.iov[i],
+			.msg_iovlen = 1,
+		};
+	}
+
+	int count = recvmmsg(sock, uplink.msgs, UPLINK_BATCH, MSG_DONTWAIT, NULL);
+	if (count == -1) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return;
+		perror("recvmmsg()");
+		event_base_loopbreak(base);
+		return;
+	}
+
+	for (int i = 0; i < count; i++) {
+		const uint8_t *data = uplink.slab[i];
+		size_t len = uplink.msgs[i].msg_len;
+		decoder.datagrams++;
+		if (len > 0 && data[0] == FEC_MAGIC)
+			fec_receive(data, len, decode_deliver);
+		else
+			decode_deliver(data, len);
+	}
+}
+
+static int decode_data(const char *in_addr) {
 	struct event_base *base = NULL;
-	struct event *sig_int = NULL, *in_ev = NULL, *temp_tmr = NULL;
-	int ret = EXIT_SUCCESS;
+	struct event *sig_int = NULL, *in_ev = NULL;
+	struct sockaddr_in sin_in = {.sin_family = AF_INET};
+	int in_sock = -1, ret = EXIT_FAILURE;
 
-	int serial_fd = open(port_name, O_RDWR | O_NOCTTY);
-	if (serial_fd < 0) {
-		printf("Error while openning port %s: %s\n", port_name, strerror(errno));
-		return EXIT_FAILURE;
-	};
-	evutil_make_socket_nonblocking(serial_fd);
+	out_sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (!parse_host_port(in_addr, &sin_in.sin_addr, &sin_in.sin_port))
+		goto err;
+	if (endpoint_count == 0 && !endpoint_add(default_out_addr))
+		goto err;
+	in_sock = socket(AF_INET, SOCK_DGRAM, 0);
+	// a parity burst follows each fec group, and bursts wait while a group is rebuilt
+	int rcvbuf = 1 << 20;
+	setsockopt(in_sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	if (bind(in_sock, (struct sockaddr *)&sin_in, sizeof(sin_in))) {
+		perror("bind()");
+		goto err;
+	}
+	printf("Decoding envelopes from %s to %d outputs\n", in_addr, endpoint_count);
 
-	struct termios options;
-	tcgetattr(serial_fd, &options);
-	cfsetspeed(&options, speed_by_value(baudrate));
+	base = event_base_new();
+	sig_int = evsignal_new(base, SIGINT, signal_cb, base);
+	event_add(sig_int, NULL);
+	signal(SIGPIPE, SIG_IGN);
 
-	options.c_cflag &= ~CSIZE;	// Mask the character size bits
-	options.c_cflag |= CS8;		// 8 bit data
-	options.c_cflag &= ~PARENB; // set parity to no
-	options.c_cflag &= ~PARODD; // set parity to no
-	options.c_cflag &= ~CSTOPB; // set one stop bit
+	egress_init(base);
+	in_ev = event_new(base, in_sock, EV_READ | EV_PERSIST, decode_read, base);
+	event_add(in_ev, NULL);
 
-	options.c_cflag |= (CLOCAL | CREAD);
-	options.c_oflag &= ~OPOST;
-	options.c_lflag &= 0;
-	options.c_iflag &= 0; // disable software flow controll
-	options.c_oflag &= 0;
+	event_base_dispatch(base);
+	ret = EXIT_SUCCESS;
+
+	egress_flush();
+	for (int i = 0; i < FEC_GROUPS; i++)
+		fec_group_end(&fec_groups[i]);
+	printf("Received %lu datagrams, %lu envelopes (%lu bytes into %lu, %.2fus per envelope), %lu "
+		   "broken\n",
+		decoder.datagrams, decoder.envelopes, decoder.unpacked_bytes, decoder.packed_bytes,
+		decoder.envelopes ? decoder.ns / 1000.0 / decoder.envelopes : 0.0, decoder.broken);
+	if (fec_decoder.data || fec_decoder.parity)
+		printf("FEC: %lu data and %lu parity datagrams, %lu rebuilt, %lu lost in groups with too "
+			   "little parity, %lu late or duplicate, %lu broken, %.2fus per datagram\n",
+			fec_decoder.data, fec_decoder.parity, fec_decoder.recovered, fec_decoder.lost,
+			fec_decoder.late, fec_decoder.broken,
+			fec_decoder.data + fec_decoder.parity
+				? fec_decoder.ns / 1000.0 / (fec_decoder.data + fec_decoder.parity)
+				: 0.0);
+	printf("Sent %lu datagrams in %lu syscalls, %lu errors\n", egress.datagrams, egress.syscalls,
+		egress.errors);
+	for (int i = 0; i < endpoint_count; i++)
+		printf("Endpoint %s: %lu datagrams, %lu bytes\n", endpoints[i].name, endpoints[i].frames,
+			endpoints[i].bytes);
 
-	cfmakeraw(&options);
-	tcsetattr(serial_fd, TCSANOW, &options);
+err:
+	if (in_ev)
+		event_free(in_ev);
+	if (sig_int)
+		event_free(sig_int);
+	if (egress.flush_ev)
+		event_free(egress.flush_ev);
+	if (in_sock >= 0)
+		close(in_sock);
+	if (out_sock > 0)
+		close(out_sock);
+	if (base)
+		event_base_free(base);
+	libevent_global_shutdown();
+	return ret;
+}
+
+static int handle_data(const char *port_name, int baudrate, const char *in_addr) {
+	struct event_base *base = NULL;
+	struct event *sig_int = NULL, *sig_usr1 = NULL, *in_ev = NULL, *temp_tmr = NULL;
+	int ret = EXIT_SUCCESS;
+
+	// RC channel commands are started by a helper, fork it while we are small
+	if (ch_count > 0)
+		cmd_executor_start();
+
+	// A replay stands in for the serial input, what is written to the port goes nowhere
+	bool replay = replays[DIR_DOWN].path;
+	int serial_fd =
+		replay ? open("/dev/null", O_RDWR | O_CLOEXEC) : serial_open(port_name, baudrate);
+	if (serial_fd < 0)
+		return EXIT_FAILURE;
 
 	out_sock = socket(AF_INET, SOCK_DGRAM, 0);
 
 	int in_sock = out_sock;
 
-	printf("Listening on %s...\n", port_name);
+	if (!replay)
+		printf("Listening on %s...\n", port_name);
 
 	struct sockaddr_in sin_in = {
 		.sin_family = AF_INET,
@@ -801,8 +5250,29 @@ static int handle_data(
 
 	if (!parse_host_port(in_addr, (struct in_addr *)&sin_in.sin_addr.s_addr, &sin_in.sin_port))
 		goto err;
-	if (!parse_host_port(out_addr, (struct in_addr *)&sin_out.sin_addr.s_addr, &sin_out.sin_port))
+	if (endpoint_count == 0 && !endpoint_add(default_out_addr))
 		goto err;
+	for (int i = 0; i < endpoint_count; i++) {
+		struct endpoint *ep = &endpoints[i];
+		if (ep->aggregate < 0)
+			ep->aggregate = aggregate;
+		if (ep->hold_us < 0)
+			ep->hold_us = hold_us;
+		ep->tokens = ep->rate * 1000;
+		ep->refill_ms = get_current_time_ms();
+		if (ep->aggregate == 0)
+			raw_endpoints = true;
+		else
+			parsed_endpoints = true;
+		if (ep->aggregate == 0 && (ep->pack || ep->fec))
+			printf("Output %s forwards the raw stream, pack and fec don't apply\n", ep->name);
+		if (verbose)
+			printf("Output to %s, aggregate %ld, hold %ldus, rate %ld B/s, %d allow / %d deny ranges\n",
+				ep->name, ep->aggregate, ep->hold_us, ep->rate, ep->allow_count, ep->deny_count);
+	}
+	if (signing.enabled)
+		printf("Signing with link id %u, %s SHA-256%s\n", signing.link.link_id,
+			mavlink_sha256_backend_name(), raw_endpoints ? ", raw outputs (-a 0) stay unsigned" : "");
 
 	if (in_sock > 0 &&
 		bind(in_sock, (struct sockaddr *)&sin_in, sizeof(sin_in))) { // we may not need this
@@ -812,7 +5282,11 @@ static int handle_data(
 	if (in_sock > 0)
 		printf("Listening on %s...\n", in_addr);
 
-	base = event_base_new();
+	// Precise timers are backed by a timerfd, the hold times are in microseconds
+	struct event_config *cfg = event_config_new();
+	event_config_set_flag(cfg, EVENT_BASE_FLAG_PRECISE_TIMER);
+	base = event_base_new_with_config(cfg);
+	event_config_free(cfg);
 
 	sig_int = evsignal_new(base, SIGINT, signal_cb, base);
 	event_add(sig_int, NULL);
@@ -820,14 +5294,51 @@ static int handle_data(
 	signal(SIGPIPE, SIG_IGN);
 
 	// Test inject a simple packet to test malvink communication Camera to Ground
-	signal(SIGUSR1, sendtestmsg);
+	sig_usr1 = evsignal_new(base, SIGUSR1, sendtestmsg, NULL);
+	event_add(sig_usr1, NULL);
+
+	egress_init(base);
+	serial_init(base, baudrate);
+	serial_out_init(base, baudrate);
+	rate_limit_init(base);
+	for (int i = 0; i < endpoint_count; i++) {
+		struct endpoint *ep = &endpoints[i];
+		for (int c = 0; c < CLASS_COUNT; c++) {
+			struct class_queue *q = &ep->queues[c];
+			q->ep = ep;
+			if (ep->aggregate > 0 && class_hold(ep, c) > 0)
+				q->hold_ev = evtimer_new(base, class_hold_cb, q);
+		}
+		if (ep->fec)
+			ep->fec->timer = evtimer_new(base, fec_timer_cb, ep->fec);
+	}
+	msg_spool_init(base);
+	stats_init(base);
+	if (!record_init(base)) {
+		ret = EXIT_FAILURE;
+		goto err;
+	}
+	if (monitor_wfb)
+		wfb_tail_init(base);
+
+	if (executor.res_fd >= 0) {
+		executor.res_ev =
+			event_new(base, executor.res_fd, EV_READ | EV_PERSIST, cmd_result_cb, NULL);
+		event_add(executor.res_ev, NULL);
+	}
 
 	serial_bev = bufferevent_socket_new(base, serial_fd, 0);
 	bufferevent_setcb(serial_bev, serial_read_cb, NULL, serial_event_cb, base);
-	bufferevent_enable(serial_bev, EV_READ);
+	// on a replay, replay_cb hands the frames to serial_read_cb
+	if (!replay && serial.reader_prio < 0)
+		bufferevent_enable(serial_bev, EV_READ);
+	else if (!replay && !serial_reader_start(base)) {
+		ret = EXIT_FAILURE;
+		goto err;
+	}
 
 	if (in_sock > 0) {
-		in_ev = event_new(base, in_sock, EV_READ | EV_PERSIST, in_read, NULL);
+		in_ev = event_new(base, in_sock, EV_READ | EV_PERSIST, in_read, base);
 		event_add(in_ev, NULL);
 	}
 	if (temp) {
@@ -843,9 +5354,59 @@ static int handle_data(
 		}
 	}
 
+	if (!replay_init(base)) {
+		ret = EXIT_FAILURE;
+		goto err;
+	}
+
 	event_base_dispatch(base);
 
+	for (int i = 0; i < endpoint_count; i++)
+		if (endpoints[i].fec)
+			fec_close_group(endpoints[i].fec);
+	egress_flush();
+	printf("Sent %lu datagrams in %lu syscalls (%.1f per syscall), %lu errors\n",
+		egress.datagrams, egress.syscalls,
+		egress.syscalls ? (double)egress.datagrams / egress.syscalls : 0.0, egress.errors);
+	for (int i = 0; i < endpoint_count; i++) {
+		printf("Endpoint %s: %lu frames, %lu bytes, %lu filtered, %lu rate limited\n",
+			endpoints[i].name, endpoints[i].frames, endpoints[i].bytes, endpoints[i].filtered,
+			endpoints[i].limited);
+		endpoint_print_pack(&endpoints[i]);
+		endpoint_print_fec(&endpoints[i]);
+		endpoint_print_hold(&endpoints[i]);
+	}
+	latency_print();
+	signing_print();
+	if (frame_pool.exhausted)
+		printf("Frame pool exhausted %lu times\n", frame_pool.exhausted);
+	printf("Received %lu uplink datagrams in %lu wakeups (%.1f per wakeup, max %u)\n",
+		uplink.datagrams, uplink.wakeups,
+		uplink.wakeups ? (double)uplink.datagrams / uplink.wakeups : 0.0, uplink.max_batch);
+	printf("Uplink %lu frames, %lu bytes queued for serial, %lu CRC errors, %lu unknown ids, %lu bytes "
+		   "dropped\n",
+		uplink_scanner.frames, uplink.written, uplink_scanner.crc_errors,
+		uplink_scanner.unknown_ids, uplink_scanner.skipped_bytes);
+
 err:
+	serial_reader_stop();
+	serial_free();
+	serial_out_free();
+	stats_free();
+	record_free();
+	replay_free();
+	rate_limit_free();
+	for (int i = 0; i < endpoint_count; i++) {
+		for (int c = 0; c < CLASS_COUNT; c++)
+			if (endpoints[i].queues[c].hold_ev)
+				event_free(endpoints[i].queues[c].hold_ev);
+		fec_encoder_free(endpoints[i].fec);
+	}
+	cmd_executor_stop();
+	msg_spool_free();
+	wfb_tail_free();
+	if (egress.flush_ev)
+		event_free(egress.flush_ev);
 	if (temp_tmr) {
 		event_del(temp_tmr);
 		event_free(temp_tmr);
@@ -869,6 +5430,8 @@ err:
 
 	if (sig_int)
 		event_free(sig_int);
+	if (sig_usr1)
+		event_free(sig_usr1);
 
 	if (base)
 		event_base_free(base);
@@ -882,12 +5445,28 @@ int main(int argc, char **argv) {
 	const struct option long_options[] = {
 		{"master", required_argument, NULL, 'm'},
 		{"baudrate", required_argument, NULL, 'b'},
+		{"rtscts", no_argument, NULL, 'F'},
+		{"low-latency", no_argument, NULL, 'L'},
+		{"read-batch", required_argument, NULL, 'B'},
+		{"rt-reader", required_argument, NULL, 'R'},
 		{"out", required_argument, NULL, 'o'},
 		{"in", required_argument, NULL, 'i'},
 		{"channels", required_argument, NULL, 'c'},
 		{"wait", required_argument, NULL, 'w'},
 		{"persist", required_argument, NULL, 'p'},
 		{"aggregate", required_argument, NULL, 'a'},
+		{"hold", required_argument, NULL, 'l'},
+		{"class", required_argument, NULL, 'q'},
+		{"limit", required_argument, NULL, 'r'},
+		{"uplink-queue", required_argument, NULL, 'u'},
+		{"stats", required_argument, NULL, 's'},
+		{"stats-shm", required_argument, NULL, 'S'},
+		{"record", required_argument, NULL, 'T'},
+		{"replay", required_argument, NULL, 'P'},
+		{"replay-udp", required_argument, NULL, 'U'},
+		{"replay-speed", required_argument, NULL, 'X'},
+		{"sign", required_argument, NULL, 'K'},
+		{"decode", no_argument, NULL, 'D'},
 		{"folder", required_argument, NULL, 'f'},
 		{"temp", no_argument, NULL, 't'},
 		{"wfb", no_argument, NULL, 'j'},
@@ -898,12 +5477,12 @@ int main(int argc, char **argv) {
 
 	const char *port_name = default_master;
 	int baudrate = default_baudrate;
-	const char *out_addr = default_out_addr;
 	const char *in_addr = default_in_addr;
+	bool decode = false;
 	int opt = 0, long_index = 0;
 	last_board_temp = -100;
 
-	while ((opt = getopt_long(argc, argv, "m:b:o:i:c:w:p:a:f:tvjh", long_options, &long_index)) != -1) {
+	while ((opt = getopt_long(argc, argv, "m:b:FLB:R:o:i:c:w:p:a:l:q:r:u:s:S:T:P:U:X:K:Df:tvjh", long_options, &long_index)) != -1) {
 		switch (opt) {
 		case 'm':
 			port_name = optarg;
@@ -911,10 +5490,40 @@ int main(int argc, char **argv) {
 
 		case 'b':
 			baudrate = atoi(optarg);
+			// B50 is the lowest termios rate, below 10 baud the uplink pacing has no byte rate
+			if (baudrate < 50) {
+				print_usage();
+				return EXIT_FAILURE;
+			}
+			break;
+
+		case 'F':
+			serial.rtscts = true;
+			break;
+
+		case 'L':
+			serial.low_latency = true;
+			break;
+
+		case 'R':
+			if (!serial_reader_set(optarg)) {
+				print_usage();
+				return EXIT_FAILURE;
+			}
+			break;
+
+		case 'B':
+			if (!serial_batch_set(optarg)) {
+				print_usage();
+				return EXIT_FAILURE;
+			}
 			break;
 
 		case 'o':
-			out_addr = optarg;
+			if (!endpoint_add(optarg)) {
+				print_usage();
+				return EXIT_FAILURE;
+			}
 			break;
 
 		case 'i':
@@ -953,6 +5562,74 @@ int main(int argc, char **argv) {
 				printf("Aggregate mavlink pckts till buffer reaches %ld bytes\n", aggregate);
 			break;
 
+		case 'l':
+			hold_us = atol(optarg);
+			if (hold_us < 0)
+				hold_us = 0;
+			break;
+
+		case 'q':
+			if (!frame_class_set(optarg)) {
+				print_usage();
+				return EXIT_FAILURE;
+			}
+			break;
+
+		case 'r':
+			if (!rate_limit_add(optarg)) {
+				print_usage();
+				return EXIT_FAILURE;
+			}
+			break;
+
+		case 'u':
+			if (!serial_out_set(optarg)) {
+				print_usage();
+				return EXIT_FAILURE;
+			}
+			break;
+
+		case 's':
+			stats.sock_path = optarg;
+			break;
+
+		case 'S':
+			stats.shm_path = optarg;
+			break;
+
+		case 'T':
+			if (!record_set(optarg)) {
+				print_usage();
+				return EXIT_FAILURE;
+			}
+			break;
+
+		case 'K':
+			if (!signing_set(optarg)) {
+				print_usage();
+				return EXIT_FAILURE;
+			}
+			break;
+
+		case 'D':
+			decode = true;
+			break;
+
+		case 'P':
+			replays[DIR_DOWN].path = optarg;
+			break;
+
+		case 'U':
+			replays[DIR_UP].path = optarg;
+			break;
+
+		case 'X':
+			if (!replay_speed_set(optarg)) {
+				print_usage();
+				return EXIT_FAILURE;
+			}
+			break;
+
 		case 'f':
 			if (optarg != NULL) {
 				snprintf(MavLinkMsgFile, sizeof(MavLinkMsgFile), "%smavlink.msg", optarg);
@@ -981,5 +5658,7 @@ int main(int argc, char **argv) {
 		}
 	}
 
-	return handle_data(port_name, baudrate, out_addr, in_addr);
+	if (decode)
+		return decode_data(in_addr);
+	return handle_data(port_name, baudrate, in_addr);
 }
@@ -55,29 +55,266 @@ static inline void crc_init(uint16_t* crcAccum)
 }
 
 
+/*
+  Buffer CRC backends.
+
+  CRC16_MCRF4XX is the reflected form of polynomial 0x1021, so besides the
+  byte-at-a-time loop above it can be computed with slice-by-8 lookup tables
+  on any CPU, and by folding 128 bit blocks with carry-less multiplies where
+  the CPU has them (PCLMULQDQ on x86, PMULL on ARMv8).
+
+  The backend is picked on the first call: the carry-less version is used if
+  it was compiled in (x86, or ARMv8 built with the crypto extension) and the
+  CPU supports it, otherwise the table version. Define MAVLINK_CRC_BACKEND
+  to CRC_BACKEND_BYTEWISE or CRC_BACKEND_TABLE to force a backend at build time.
+ */
+#define CRC_BACKEND_BYTEWISE 0
+#define CRC_BACKEND_TABLE 1
+#define CRC_BACKEND_CLMUL 2
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <wmmintrin.h>
+#define MAVLINK_CRC_HAVE_CLMUL 1
+#elif defined(__aarch64__) && (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_AES))
+#include <arm_neon.h>
+#define MAVLINK_CRC_HAVE_CLMUL 1
+#endif
+
+/* shorter buffers are not worth the setup of the carry-less path */
+#define CRC_CLMUL_MIN_LEN 64
+
+static uint16_t crc_table[8][256];
+static uint64_t crc_fold_k128[2], crc_fold_k512[2];
+static int crc_backend = -1;
+
 /**
- * @brief Calculates the CRC16_MCRF4XX checksum on a byte buffer
- *
- * @param  pBuffer buffer containing the byte array to hash
- * @param  length  length of the byte array
- * @return the checksum over the buffer bytes
+ * @brief Accumulate the CRC one byte at a time, reference for the other backends
  **/
-static inline uint16_t crc_calculate(const uint8_t* pBuffer, uint16_t length)
+static inline void crc_accumulate_bytewise(uint16_t *crcAccum, const uint8_t *p, uint16_t length)
 {
-        uint16_t crcTmp;
-        crc_init(&crcTmp);
 	while (length--) {
-                crc_accumulate(*pBuffer++, &crcTmp);
+                crc_accumulate(*p++, crcAccum);
         }
-        return crcTmp;
+}
+
+/* x^n mod P bit-reflected into the top of a 64 bit word, as the fold multiplies expect it */
+static inline uint64_t crc_xpow_mod_reflected(unsigned n)
+{
+	uint32_t r = 1;
+	uint64_t out = 0;
+	while (n--) {
+		r <<= 1;
+		if (r & 0x10000)
+			r ^= 0x11021;
+	}
+	for (int i = 0; i < 16; i++) {
+		if (r & (1u << i))
+			out |= 1ULL << (63 - i);
+	}
+	return out;
+}
+
+static inline void crc_init_tables(void)
+{
+	for (int i = 0; i < 256; i++) {
+		uint16_t crc = 0;
+		crc_accumulate((uint8_t)i, &crc);
+		crc_table[0][i] = crc;
+	}
+	for (int i = 0; i < 256; i++) {
+		for (int t = 1; t < 8; t++) {
+			uint16_t prev = crc_table[t-1][i];
+			crc_table[t][i] = (prev >> 8) ^ crc_table[0][prev & 0xff];
+		}
+	}
+	/* fold distances of one and of four 128 bit blocks */
+	crc_fold_k128[0] = crc_xpow_mod_reflected(128 + 64 - 1);
+	crc_fold_k128[1] = crc_xpow_mod_reflected(128 - 1);
+	crc_fold_k512[0] = crc_xpow_mod_reflected(512 + 64 - 1);
+	crc_fold_k512[1] = crc_xpow_mod_reflected(512 - 1);
+}
+
+/**
+ * @brief Accumulate the CRC eight bytes at a time with the slice-by-8 tables
+ *
+ * crc_init_tables() must have run before, crc_accumulate_buffer() takes care of that.
+ **/
+static inline void crc_accumulate_table(uint16_t *crcAccum, const uint8_t *p, uint16_t length)
+{
+	uint16_t crc = *crcAccum;
+
+	while (length >= 8) {
+		uint32_t a = (p[0] | (p[1] << 8)) ^ crc;
+		crc = crc_table[7][a & 0xff] ^ crc_table[6][a >> 8] ^
+			crc_table[5][p[2]] ^ crc_table[4][p[3]] ^
+			crc_table[3][p[4]] ^ crc_table[2][p[5]] ^
+			crc_table[1][p[6]] ^ crc_table[0][p[7]];
+		p += 8;
+		length -= 8;
+	}
+	if (length >= 4) {
+		uint32_t a = (p[0] | (p[1] << 8)) ^ crc;
+		crc = crc_table[3][a & 0xff] ^ crc_table[2][a >> 8] ^
+			crc_table[1][p[2]] ^ crc_table[0][p[3]];
+		p += 4;
+		length -= 4;
+	}
+	while (length--) {
+		crc = (crc >> 8) ^ crc_table[0][(crc ^ *p++) & 0xff];
+	}
+	*crcAccum = crc;
+}
+
+#ifdef MAVLINK_CRC_HAVE_CLMUL
+/*
+  Folding: a 128 bit block X followed by D more bits is congruent to
+  X.lo * (x^(D+63) mod P) ^ X.hi * (x^(D-1) mod P), one power less than the
+  distance because the product of two reflected 64 bit values comes out one
+  bit short of a reflected 128 bit value. What is left after the last fold is
+  a 16 byte block with the same CRC as everything folded into it.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("pclmul,sse2")))
+static inline __m128i crc_fold_clmul(__m128i x, __m128i k)
+{
+	return _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), _mm_clmulepi64_si128(x, k, 0x11));
+}
+
+__attribute__((target("pclmul,sse2")))
+static inline void crc_accumulate_clmul(uint16_t *crcAccum, const uint8_t *p, uint16_t length)
+{
+	const __m128i k128 = _mm_loadu_si128((const __m128i *)crc_fold_k128);
+	const __m128i k512 = _mm_loadu_si128((const __m128i *)crc_fold_k512);
+	__m128i x0 = _mm_loadu_si128((const __m128i *)p);
+	__m128i x1 = _mm_loadu_si128((const __m128i *)(p + 16));
+	__m128i x2 = _mm_loadu_si128((const __m128i *)(p + 32));
+	__m128i x3 = _mm_loadu_si128((const __m128i *)(p + 48));
+	uint8_t last[16];
+
+	x0 = _mm_xor_si128(x0, _mm_cvtsi32_si128(*crcAccum));
+	p += 64;
+	length -= 64;
+	while (length >= 64) {
+		x0 = _mm_xor_si128(crc_fold_clmul(x0, k512), _mm_loadu_si128((const __m128i *)p));
+		x1 = _mm_xor_si128(crc_fold_clmul(x1, k512), _mm_loadu_si128((const __m128i *)(p + 16)));
+		x2 = _mm_xor_si128(crc_fold_clmul(x2, k512), _mm_loadu_si128((const __m128i *)(p + 32)));
+		x3 = _mm_xor_si128(crc_fold_clmul(x3, k512), _mm_loadu_si128((const __m128i *)(p + 48)));
+		p += 64;
+		length -= 64;
+	}
+	x1 = _mm_xor_si128(x1, crc_fold_clmul(x0, k128));
+	x2 = _mm_xor_si128(x2, crc_fold_clmul(x1, k128));
+	x3 = _mm_xor_si128(x3, crc_fold_clmul(x2, k128));
+	while (length >= 16) {
+		x3 = _mm_xor_si128(crc_fold_clmul(x3, k128), _mm_loadu_si128((const __m128i *)p));
+		p += 16;
+		length -= 16;
+	}
+	_mm_storeu_si128((__m128i *)last, x3);
+
+	*crcAccum = 0;
+	crc_accumulate_table(crcAccum, last, sizeof(last));
+	crc_accumulate_table(crcAccum, p, length);
+}
+
+static inline int crc_clmul_supported(void)
+{
+	return __builtin_cpu_supports("pclmul");
+}
+#else
+static inline uint64x2_t crc_fold_clmul(uint64x2_t x, poly64x2_t k)
+{
+	poly64x2_t px = vreinterpretq_p64_u64(x);
+	poly128_t lo = vmull_p64(vgetq_lane_p64(px, 0), vgetq_lane_p64(k, 0));
+	poly128_t hi = vmull_high_p64(px, k);
+	return veorq_u64(vreinterpretq_u64_p128(lo), vreinterpretq_u64_p128(hi));
+}
+
+static inline uint64x2_t crc_load_clmul(const uint8_t *p)
+{
+	return vreinterpretq_u64_u8(vld1q_u8(p));
+}
+
+static inline void crc_accumulate_clmul(uint16_t *crcAccum, const uint8_t *p, uint16_t length)
+{
+	const poly64x2_t k128 = vreinterpretq_p64_u64(vld1q_u64(crc_fold_k128));
+	const poly64x2_t k512 = vreinterpretq_p64_u64(vld1q_u64(crc_fold_k512));
+	uint64x2_t x0 = crc_load_clmul(p);
+	uint64x2_t x1 = crc_load_clmul(p + 16);
+	uint64x2_t x2 = crc_load_clmul(p + 32);
+	uint64x2_t x3 = crc_load_clmul(p + 48);
+	uint8_t last[16];
+
+	x0 = veorq_u64(x0, vsetq_lane_u64(*crcAccum, vdupq_n_u64(0), 0));
+	p += 64;
+	length -= 64;
+	while (length >= 64) {
+		x0 = veorq_u64(crc_fold_clmul(x0, k512), crc_load_clmul(p));
+		x1 = veorq_u64(crc_fold_clmul(x1, k512), crc_load_clmul(p + 16));
+		x2 = veorq_u64(crc_fold_clmul(x2, k512), crc_load_clmul(p + 32));
+		x3 = veorq_u64(crc_fold_clmul(x3, k512), crc_load_clmul(p + 48));
+		p += 64;
+		length -= 64;
+	}
+	x1 = veorq_u64(x1, crc_fold_clmul(x0, k128));
+	x2 = veorq_u64(x2, crc_fold_clmul(x1, k128));
+	x3 = veorq_u64(x3, crc_fold_clmul(x2, k128));
+	while (length >= 16) {
+		x3 = veorq_u64(crc_fold_clmul(x3, k128), crc_load_clmul(p));
+		p += 16;
+		length -= 16;
+	}
+	vst1q_u8(last, vreinterpretq_u8_u64(x3));
+
+	*crcAccum = 0;
+	crc_accumulate_table(crcAccum, last, sizeof(last));
+	crc_accumulate_table(crcAccum, p, length);
+}
+
+static inline int crc_clmul_supported(void)
+{
+	return 1; /* only compiled in when the target has the crypto extension */
+}
+#endif
+#endif // MAVLINK_CRC_HAVE_CLMUL
+
+/**
+ * @brief Select the buffer CRC backend, runs once on the first buffer CRC
+ *
+ * @return the selected CRC_BACKEND_*
+ **/
+static inline int crc_select_backend(void)
+{
+	if (crc_backend >= 0)
+		return crc_backend;
+	crc_init_tables();
+#if defined(MAVLINK_CRC_BACKEND)
+	crc_backend = MAVLINK_CRC_BACKEND;
+#elif defined(MAVLINK_CRC_HAVE_CLMUL)
+	crc_backend = crc_clmul_supported() ? CRC_BACKEND_CLMUL : CRC_BACKEND_TABLE;
+#else
+	crc_backend = CRC_BACKEND_TABLE;
+#endif
+	return crc_backend;
+}
+
+static inline const char *crc_backend_name(void)
+{
+	switch (crc_select_backend()) {
+	case CRC_BACKEND_TABLE:
+		return "slice-by-8";
+	case CRC_BACKEND_CLMUL:
+		return "clmul";
+	default:
+		return "bytewise";
+	}
 }
 
 
 /**
  * @brief Accumulate the MCRF4XX CRC16 by adding an array of bytes
  *
- * The checksum function adds the hash of one char at a time to the
- * 16 bit checksum (uint16_t).
+ * Uses the fastest backend available, see crc_select_backend().
  *
  * @param data new bytes to hash
  * @param crcAccum the already accumulated checksum
@@ -85,9 +322,39 @@ static inline uint16_t crc_calculate(const uint8_t* pBuffer, uint16_t length)
 static inline void crc_accumulate_buffer(uint16_t *crcAccum, const char *pBuffer, uint16_t length)
 {
 	const uint8_t *p = (const uint8_t *)pBuffer;
-	while (length--) {
-                crc_accumulate(*p++, crcAccum);
-        }
+	switch (crc_select_backend()) {
+#ifdef MAVLINK_CRC_HAVE_CLMUL
+	case CRC_BACKEND_CLMUL:
+		if (length >= CRC_CLMUL_MIN_LEN) {
+			crc_accumulate_clmul(crcAccum, p, length);
+			break;
+		}
+		crc_accumulate_table(crcAccum, p, length);
+		break;
+#endif
+	case CRC_BACKEND_TABLE:
+		crc_accumulate_table(crcAccum, p, length);
+		break;
+	default:
+		crc_accumulate_bytewise(crcAccum, p, length);
+		break;
+	}
+}
+
+
+/**
+ * @brief Calculates the CRC16_MCRF4XX checksum on a byte buffer
+ *
+ * @param  pBuffer buffer containing the byte array to hash
+ * @param  length  length of the byte array
+ * @return the checksum over the buffer bytes
+ **/
+static inline uint16_t crc_calculate(const uint8_t* pBuffer, uint16_t length)
+{
+        uint16_t crcTmp;
+        crc_init(&crcTmp);
+        crc_accumulate_buffer(&crcTmp, (const char *)pBuffer, length);
+        return crcTmp;
 }
 
 #if defined(MAVLINK_USE_CXX_NAMESPACE) || defined(__cplusplus)
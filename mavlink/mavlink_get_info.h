@@ -3,37 +3,23 @@
 #ifdef MAVLINK_USE_MESSAGE_INFO
 #define MAVLINK_HAVE_GET_MESSAGE_INFO
 
+#include "mavlink_msg_index.h"
+
 /*
   return the message_info struct for a message
 */
 MAVLINK_HELPER const mavlink_message_info_t *mavlink_get_message_info_by_id(uint32_t msgid)
 {
 	static const mavlink_message_info_t mavlink_message_info[] = MAVLINK_MESSAGE_INFO;
+	static mavlink_msg_index_t mavlink_message_info_index;
 	/*
-	  use a bisection search to find the right entry. A perfect hash may be better
+	  O(1) lookup through the index of mavlink_msg_index.h
 	  Note that this assumes the table is sorted with primary key msgid
 	*/
 	const uint32_t count = sizeof(mavlink_message_info)/sizeof(mavlink_message_info[0]);
-	if (count == 0) {
-		return NULL;
-	}
-	uint32_t low=0, high=count-1;
-	while (low < high) {
-		uint32_t mid = (low+high)/2;
-		if (msgid < mavlink_message_info[mid].msgid) {
-			high = mid;
-			continue;
-		}
-		if (msgid > mavlink_message_info[mid].msgid) {
-			low = mid+1;
-			continue;
-		}
-		return &mavlink_message_info[mid];
-	}
-	if (mavlink_message_info[low].msgid == msgid) {
-		return &mavlink_message_info[low];
-	}
-	return NULL;
+	int pos = mavlink_msg_index_find(&mavlink_message_info_index, mavlink_message_info, count,
+					 sizeof(mavlink_message_info[0]), msgid);
+	return pos < 0 ? NULL : &mavlink_message_info[pos];
 }
 
 /*
@@ -4,6 +4,7 @@
 #include "checksum.h"
 #include "mavlink_types.h"
 #include "mavlink_conversions.h"
+#include "mavlink_msg_index.h"
 #include <stdio.h>
 
 #ifndef MAVLINK_HELPER
@@ -515,9 +516,14 @@ MAVLINK_HELPER void mavlink_update_checksum(mavlink_message_t* msg, uint8_t c)
   return the crc_entry value for a msgid
 */
 #ifndef MAVLINK_GET_MSG_ENTRY
-MAVLINK_HELPER const mavlink_msg_entry_t *mavlink_get_msg_entry(uint32_t msgid)
+static const mavlink_msg_entry_t mavlink_message_crcs[] = MAVLINK_MESSAGE_CRCS;
+static mavlink_msg_index_t mavlink_message_crcs_index;
+
+/*
+  reference lookup, mavlink_get_msg_entry() uses the O(1) index of mavlink_msg_index.h
+*/
+MAVLINK_HELPER const mavlink_msg_entry_t *mavlink_get_msg_entry_bisect(uint32_t msgid)
 {
-	static const mavlink_msg_entry_t mavlink_message_crcs[] = MAVLINK_MESSAGE_CRCS;
         /*
 	  use a bisection search to find the right entry. A perfect hash may be better
 	  Note that this assumes the table is sorted by msgid
@@ -542,6 +548,14 @@ MAVLINK_HELPER const mavlink_msg_entry_t *mavlink_get_msg_entry(uint32_t msgid)
         }
         return &mavlink_message_crcs[low];
 }
+
+MAVLINK_HELPER const mavlink_msg_entry_t *mavlink_get_msg_entry(uint32_t msgid)
+{
+	int pos = mavlink_msg_index_find(&mavlink_message_crcs_index, mavlink_message_crcs,
+					 sizeof(mavlink_message_crcs)/sizeof(mavlink_message_crcs[0]),
+					 sizeof(mavlink_message_crcs[0]), msgid);
+	return pos < 0 ? NULL : &mavlink_message_crcs[pos];
+}
 #endif // MAVLINK_GET_MSG_ENTRY
 
 /*
@@ -0,0 +1,124 @@
+#pragma once
+
+/*
+  O(1) msgid lookup for the sorted message tables generated by mavgen
+  (MAVLINK_MESSAGE_CRCS, MAVLINK_MESSAGE_INFO).
+
+  Message ids below MAVLINK_MSG_INDEX_DENSE are looked up directly. The few
+  larger ids (9000, Open Drone ID at 12900+, ...) go through a multiplicative
+  perfect hash whose multiplier is searched for when the index is built on the
+  first lookup, so it fits whatever dialect the tables come from. Should no
+  perfect hash fit, large ids fall back to bisection.
+
+  The tables only need msgid as their first member.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef MAVLINK_MSG_INDEX_DENSE
+#define MAVLINK_MSG_INDEX_DENSE 512
+#endif
+#define MAVLINK_MSG_INDEX_SPARSE_BITS_MAX 10
+
+#define MAVLINK_MSG_INDEX_EMPTY 0
+#define MAVLINK_MSG_INDEX_HASHED 1
+#define MAVLINK_MSG_INDEX_BISECT 2
+
+typedef struct __mavlink_msg_index {
+	uint16_t dense[MAVLINK_MSG_INDEX_DENSE];                 // table position + 1, 0 if no such message
+	uint16_t sparse[1 << MAVLINK_MSG_INDEX_SPARSE_BITS_MAX]; // same, at the hash of the msgid
+	uint32_t sparse_mul;
+	uint8_t sparse_shift;
+	uint8_t state;                                           // MAVLINK_MSG_INDEX_*
+} mavlink_msg_index_t;
+
+static inline uint32_t mavlink_msg_index_id(const void *table, size_t stride, size_t i)
+{
+	return *(const uint32_t *)((const uint8_t *)table + i * stride);
+}
+
+static inline uint32_t mavlink_msg_index_hash(const mavlink_msg_index_t *ix, uint32_t msgid)
+{
+	return (uint32_t)(msgid * ix->sparse_mul) >> ix->sparse_shift;
+}
+
+/*
+  build the index of a table of count entries, stride bytes apart
+*/
+static inline void mavlink_msg_index_build(mavlink_msg_index_t *ix, const void *table, size_t count, size_t stride)
+{
+	size_t nsparse = 0;
+	unsigned bits = 4;
+	uint32_t seed = 0x9E3779B9;
+
+	memset(ix, 0, sizeof(*ix));
+	for (size_t i = 0; i < count; i++) {
+		uint32_t msgid = mavlink_msg_index_id(table, stride, i);
+		if (msgid < MAVLINK_MSG_INDEX_DENSE)
+			ix->dense[msgid] = i + 1;
+		else
+			nsparse++;
+	}
+	ix->state = MAVLINK_MSG_INDEX_HASHED;
+	if (nsparse == 0)
+		return;
+
+	while ((1u << bits) < 2 * nsparse)
+		bits++;
+	for (; bits <= MAVLINK_MSG_INDEX_SPARSE_BITS_MAX; bits++) {
+		for (int attempt = 0; attempt < 1000; attempt++) {
+			bool collision = false;
+			seed = seed * 1664525 + 1013904223;
+			ix->sparse_mul = seed | 1;
+			ix->sparse_shift = 32 - bits;
+			memset(ix->sparse, 0, sizeof(ix->sparse));
+			for (size_t i = 0; i < count && !collision; i++) {
+				uint32_t msgid = mavlink_msg_index_id(table, stride, i);
+				if (msgid < MAVLINK_MSG_INDEX_DENSE)
+					continue;
+				uint32_t h = mavlink_msg_index_hash(ix, msgid);
+				collision = ix->sparse[h] != 0;
+				ix->sparse[h] = i + 1;
+			}
+			if (!collision)
+				return;
+		}
+	}
+	ix->state = MAVLINK_MSG_INDEX_BISECT;
+}
+
+/*
+  return the table position of msgid, -1 if it is not in the table
+*/
+static inline int mavlink_msg_index_find(mavlink_msg_index_t *ix, const void *table, size_t count, size_t stride, uint32_t msgid)
+{
+	uint32_t pos;
+
+	if (ix->state == MAVLINK_MSG_INDEX_EMPTY)
+		mavlink_msg_index_build(ix, table, count, stride);
+
+	if (msgid < MAVLINK_MSG_INDEX_DENSE)
+		return (int)ix->dense[msgid] - 1;
+
+	if (ix->state == MAVLINK_MSG_INDEX_HASHED) {
+		pos = ix->sparse[mavlink_msg_index_hash(ix, msgid)];
+		if (pos != 0 && mavlink_msg_index_id(table, stride, pos - 1) == msgid)
+			return pos - 1;
+		return -1;
+	}
+
+	uint32_t low = 0, high = count;
+	while (low < high) {
+		uint32_t mid = (low + high) / 2;
+		if (mavlink_msg_index_id(table, stride, mid) < msgid)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if (low < count && mavlink_msg_index_id(table, stride, low) == msgid)
+		return low;
+	return -1;
+}
@@ -42,6 +42,20 @@
 */
 #ifndef HAVE_MAVLINK_SHA256
 
+/* hardware backends, see the block backends below */
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <cpuid.h>
+#include <immintrin.h>
+#define MAVLINK_SHA256_HAVE_SHANI 1
+#elif (defined(__aarch64__) || defined(__arm__)) && \
+	(defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRYPTO))
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#endif
+#define MAVLINK_SHA256_HAVE_ARMV8 1
+#endif
+
 #ifdef MAVLINK_USE_CXX_NAMESPACE
 namespace mavlink {
 #endif
@@ -149,6 +163,177 @@ static inline void mavlink_sha256_calc(mavlink_sha256_ctx *m, uint32_t *in)
     m->counter[7] += HH;
 }
 
+/*
+  Block backends.
+
+  Besides the portable rounds above, the compression function can run on the
+  SHA-256 instructions of the CPU: SHA-NI on x86 and the ARMv8 Cryptography
+  Extensions (SHA256H/SHA256H2/SHA256SU0/SHA256SU1). Signing a MAVLink 2
+  frame hashes two or three 64 byte blocks, so the rounds are nearly all of
+  its cost.
+
+  The backend is picked on the first block: a hardware one is used if it was
+  compiled in (x86 with GCC or clang, or ARM built with the crypto extension,
+  e.g. -march=armv8-a+crypto) and the CPU has it, otherwise the portable one.
+  Define MAVLINK_SHA256_BACKEND to SHA256_BACKEND_PORTABLE to force it at
+  build time.
+ */
+#define SHA256_BACKEND_PORTABLE 0
+#define SHA256_BACKEND_SHANI 1
+#define SHA256_BACKEND_ARMV8 2
+
+static int mavlink_sha256_backend = -1;
+
+/* the portable rounds take the block as big endian words */
+static inline void mavlink_sha256_portable(mavlink_sha256_ctx *m, const uint8_t *block)
+{
+    uint32_t current[16];
+    int i;
+    for (i = 0; i < 16; i++) {
+        const uint8_t *b = block + 4 * i;
+        current[i] = ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+    }
+    mavlink_sha256_calc(m, current);
+}
+
+#ifdef MAVLINK_SHA256_HAVE_SHANI
+/*
+  The state lives in two registers as ABEF and CDGH. Each SHA256RNDS2 does two
+  rounds, the message words of the next four rounds are computed with
+  SHA256MSG1/SHA256MSG2 while the current ones are used.
+ */
+__attribute__((target("sha,sse4.1")))
+static inline void mavlink_sha256_shani(uint32_t state[8], const uint8_t *block)
+{
+    const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1); /* CDAB */
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B); /* EFGH */
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8); /* ABEF */
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0); /* CDGH */
+    const __m128i abef = state0, cdgh = state1;
+    __m128i msg[4];
+    int r;
+
+    for (r = 0; r < 4; r++)
+        msg[r] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block + 16 * r)), bswap);
+    for (r = 0; r < 16; r++) {
+        __m128i wk = _mm_add_epi32(msg[r & 3],
+            _mm_loadu_si128((const __m128i *)&mavlink_sha256_constant_256[4 * r]));
+        if (r < 12) {
+            /* words 16..19 ahead: W[t-16] + s0(W[t-15]) + W[t-7] + s1(W[t-2]) */
+            __m128i w = _mm_sha256msg1_epu32(msg[r & 3], msg[(r + 1) & 3]);
+            w = _mm_add_epi32(w, _mm_alignr_epi8(msg[(r + 3) & 3], msg[(r + 2) & 3], 4));
+            msg[r & 3] = _mm_sha256msg2_epu32(w, msg[(r + 3) & 3]);
+        }
+        state1 = _mm_sha256rnds2_epu32(state1, state0, wk);
+        state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(wk, 0x0E));
+    }
+
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+    tmp = _mm_shuffle_epi32(state0, 0x1B); /* FEBA */
+    state1 = _mm_shuffle_epi32(state1, 0xB1); /* DCHG */
+    _mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(tmp, state1, 0xF0)); /* DCBA */
+    _mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(state1, tmp, 8)); /* HGFE */
+}
+
+static inline int mavlink_sha256_hw_supported(void)
+{
+    unsigned int a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSE4_1) || !(c & bit_SSSE3))
+        return 0;
+    return __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1u << 29)); /* SHA */
+}
+#endif
+
+#ifdef MAVLINK_SHA256_HAVE_ARMV8
+static inline void mavlink_sha256_armv8(uint32_t state[8], const uint8_t *block)
+{
+    uint32x4_t abcd = vld1q_u32(&state[0]), efgh = vld1q_u32(&state[4]);
+    const uint32x4_t abcd0 = abcd, efgh0 = efgh;
+    uint32x4_t msg[4];
+    int r;
+
+    for (r = 0; r < 4; r++)
+        msg[r] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(block + 16 * r)));
+    for (r = 0; r < 16; r++) {
+        uint32x4_t wk = vaddq_u32(msg[r & 3], vld1q_u32(&mavlink_sha256_constant_256[4 * r]));
+        uint32x4_t prev = abcd;
+        if (r < 12)
+            msg[r & 3] = vsha256su1q_u32(vsha256su0q_u32(msg[r & 3], msg[(r + 1) & 3]),
+                msg[(r + 2) & 3], msg[(r + 3) & 3]);
+        abcd = vsha256hq_u32(abcd, efgh, wk);
+        efgh = vsha256h2q_u32(efgh, prev, wk);
+    }
+    vst1q_u32(&state[0], vaddq_u32(abcd, abcd0));
+    vst1q_u32(&state[4], vaddq_u32(efgh, efgh0));
+}
+
+static inline int mavlink_sha256_hw_supported(void)
+{
+#if defined(__linux__) && defined(__aarch64__)
+    return (getauxval(AT_HWCAP) & (1 << 6)) != 0; /* HWCAP_SHA2 */
+#elif defined(__linux__)
+    return (getauxval(AT_HWCAP2) & (1 << 3)) != 0; /* HWCAP2_SHA2 */
+#else
+    return 1; /* compiled for a target that has it */
+#endif
+}
+#endif
+
+/**
+ * @brief Select the SHA-256 block backend, runs once on the first block
+ *
+ * @return the selected SHA256_BACKEND_*
+ **/
+static inline int mavlink_sha256_select_backend(void)
+{
+    if (mavlink_sha256_backend >= 0)
+        return mavlink_sha256_backend;
+#if defined(MAVLINK_SHA256_BACKEND)
+    mavlink_sha256_backend = MAVLINK_SHA256_BACKEND;
+#elif defined(MAVLINK_SHA256_HAVE_SHANI)
+    mavlink_sha256_backend = mavlink_sha256_hw_supported() ? SHA256_BACKEND_SHANI : SHA256_BACKEND_PORTABLE;
+#elif defined(MAVLINK_SHA256_HAVE_ARMV8)
+    mavlink_sha256_backend = mavlink_sha256_hw_supported() ? SHA256_BACKEND_ARMV8 : SHA256_BACKEND_PORTABLE;
+#else
+    mavlink_sha256_backend = SHA256_BACKEND_PORTABLE;
+#endif
+    return mavlink_sha256_backend;
+}
+
+static inline const char *mavlink_sha256_backend_name(void)
+{
+    switch (mavlink_sha256_select_backend()) {
+    case SHA256_BACKEND_SHANI:
+        return "sha-ni";
+    case SHA256_BACKEND_ARMV8:
+        return "armv8-ce";
+    default:
+        return "portable";
+    }
+}
+
+/* one 64 byte block into the state, with the selected backend */
+static inline void mavlink_sha256_block(mavlink_sha256_ctx *m, const uint8_t *block)
+{
+    switch (mavlink_sha256_select_backend()) {
+#ifdef MAVLINK_SHA256_HAVE_SHANI
+    case SHA256_BACKEND_SHANI:
+        mavlink_sha256_shani(m->counter, block);
+        break;
+#endif
+#ifdef MAVLINK_SHA256_HAVE_ARMV8
+    case SHA256_BACKEND_ARMV8:
+        mavlink_sha256_armv8(m->counter, block);
+        break;
+#endif
+    default:
+        mavlink_sha256_portable(m, block);
+        break;
+    }
+}
+
 MAVLINK_HELPER void mavlink_sha256_update(mavlink_sha256_ctx *m, const void *v, uint32_t len)
 {
     const unsigned char *p = (const unsigned char *)v;
@@ -169,18 +354,7 @@ MAVLINK_HELPER void mavlink_sha256_update(mavlink_sha256_ctx *m, const void *v,
 	p += l;
 	len -= l;
 	if(offset == 64){
-	    int i;
-	    uint32_t current[16];
-	    const uint32_t *u = m->u.save_u32;
-	    for (i = 0; i < 16; i++){
-                const uint8_t *p1 = (const uint8_t *)&u[i];
-                uint8_t *p2 = (uint8_t *)&current[i];
-                p2[0] = p1[3];
-                p2[1] = p1[2];
-                p2[2] = p1[1];
-                p2[3] = p1[0];
-	    }
-	    mavlink_sha256_calc(m, current);
+	    mavlink_sha256_block(m, m->u.save_bytes);
 	    offset = 0;
 	}
     }